@@ -0,0 +1,173 @@
+/* Benchmark of the maze library. For every size of the sweep it generates, solves, renders and writes a maze, timing each stage on its own,
+ * and prints the throughput of each stage, the peak memory use and a checksum of the grid. The checksum only depends on the seed and the
+ * generator settings, so it shows whether a performance change also changed the mazes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "mazelib.h"
+
+#define MAXLIST 32 /* longest list of sizes or resolutions */
+
+/* time spent rendering and writing one image */
+typedef struct {
+    double render;
+    double write;
+    uint64_t bytes; /* length of the written file */
+} drawing;
+
+void benchSize(settings const *set, int const *res, int resCount, char *name); /* run every stage for one maze size and print a line per resolution and color mode */
+uint64_t checksum(grid const *map); /* FNV-1a hash of the cells of map */
+drawing draw(maze *m, settings const *set, char *name); /* write the image of m with the given settings through mwrite */
+int parseList(char *text, int *list); /* read a comma separated list of numbers, returns its length */
+long peakMemory(); /* peak resident set size in KB */
+void printHelp(); /* print a description and a list of command line options */
+
+int main(int argc, char **argv) {
+    int sizes[MAXLIST] = {100, 300, 1000, 3000, 10000, 20000};
+    int res[MAXLIST] = {1, 5};
+    int sizeCount = 6, resCount = 2;
+    char *name = "bench.tiff";
+    settings set = {.seed = 1, .algo = GROWTH, .tile = TILESIZE};
+    set.renderers = sysconf(_SC_NPROCESSORS_ONLN);
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp("-help",argv[i])) {
+            printHelp();
+            return 0;
+        }
+        else if(!strcmp("-sizes",argv[i]) && i < argc - 1)
+            sizeCount = parseList(argv[++i], sizes);
+        else if(!strcmp("-res",argv[i]) && i < argc - 1)
+            resCount = parseList(argv[++i], res);
+        else if(!strcmp("-tile",argv[i]) && i < argc - 1)
+            set.tile = atoi(argv[++i]);
+        else if(!strcmp("-algo",argv[i]) && i < argc - 1) {
+            for(set.algo = ALGORITHMS - 1, ++i; set.algo >= 0 && strcmp(algorithms[set.algo], argv[i]); --set.algo);
+            if(set.algo < 0) {
+                printf("\033[1;31merror: \033[0m Unknown algorithm '%s'.\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(!strcmp("-S",argv[i]) && i < argc - 1)
+            set.seed = atoi(argv[++i]);
+        else if(!strcmp("-j",argv[i]) && i < argc - 1)
+            set.threads = atoi(argv[++i]);
+        else if(!strcmp("-n",argv[i]) && i < argc - 1)
+            name = argv[++i];
+        else if(!strcmp("-workers",argv[i]) && i < argc - 1)
+            set.renderers = atoi(argv[++i]);
+        else {
+            printf("\033[1;31merror: \033[0mInvalid argument usage: '%s'\n\n",argv[i]);
+            printHelp();
+            return 1;
+        }
+    }
+    for(int k = 0; k < resCount; ++k) {
+        if(res[k] < 1) {
+            printf("\033[1;31merror: \033[0m Resolutions smaller than 1 are invalid.\n");
+            return 1;
+        }
+    }
+
+    printf("size\tres\tcolor\tgenerate cells/s\tsolve cells/s\trender px/s\tencode+write MB/s\tfile MB\tpeak RSS MB\tgrid checksum\n");
+    for(int k = 0; k < sizeCount; ++k) {
+        if(sizes[k] < 3) {
+            printf("\033[1;31merror: \033[0m Maze dimensions smaller than 3 are invalid.\n");
+            return 1;
+        }
+        set.wid = set.hei = sizes[k] + 2;
+        fflush(stdout);
+        /* each size runs in its own process, so the peak memory use is its own */
+        pid_t child = fork();
+        if(child == 0) {
+            benchSize(&set, res, resCount, name);
+            exit(0);
+        }
+        waitpid(child, NULL, 0);
+    }
+    unlink(name);
+    return 0;
+}
+
+void benchSize(settings const *set, int const *res, int resCount, char *name) {
+    settings plain = *set;
+    settings colored;
+    double start, generate, solve;
+    uint64_t sum;
+    size_t cells = (size_t) set->wid * set->hei;
+    maze *m = mopen(&plain);
+    drawing d;
+
+    start = now();
+    mmake(m);
+    generate = now() - start;
+    sum = checksum(m->map);
+    colored = plain;
+    colored.solve = HEATMAP | SOLUTION;
+    mreset(m, &colored); /* keeps the grid, only the solver runs */
+    start = now();
+    mmake(m);
+    solve = now() - start;
+
+    for(int k = 0; k < resCount; ++k) {
+        for(int color = 0; color < 2; ++color) {
+            settings drawn = color ? colored : plain;
+            drawn.res = res[k];
+            d = draw(m, &drawn, name);
+            double pixels = (double) (set->wid - 2) * (set->hei - 2) * res[k] * res[k];
+            printf("%d\t%d\t%s\t%.3g\t%.3g\t%.3g\t%.1f\t%.2f\t%.1f\t%016llx\n", set->wid - 2, res[k], color ? "yes" : "no",
+                cells / generate, cells / solve, pixels / d.render, d.bytes / 1e6 / d.write, d.bytes / 1e6, peakMemory() / 1024.0, (unsigned long long) sum);
+            fflush(stdout);
+        }
+    }
+    mclose(m);
+}
+
+/* the image is written by mwrite itself, so the benchmark takes the same path to the file as maze does, mapped or streamed and
+ * rendered on set->renderers threads. Its timers keep the rendering and the writing of the strips apart */
+drawing draw(maze *m, settings const *set, char *name) {
+    stats st = {0};
+    struct stat written;
+    FILE *fp = fopen(name, "w+b"); /* readable too, so mwrite can map it */
+    mreset(m, set); /* the same maze, made and solved already */
+    m->stats = &st;
+    if(!fp || mwrite(m, fp)) {
+        printf("\033[1;31merror: \033[0m Could not write '%s'.\n", name);
+        exit(1);
+    }
+    m->stats = NULL;
+    return (drawing) {st.render, st.write, stat(name, &written) ? 0 : written.st_size};
+}
+
+uint64_t checksum(grid const *map) {
+    uint64_t hash = 14695981039346656037ull;
+    for(int y = 0; y < map->hei; ++y) {
+        for(int x = 0; x < map->wid; ++x) {
+            hash ^= GET(map,x,y);
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+int parseList(char *text, int *list) {
+    int count = 0;
+    for(char *item = strtok(text, ","); item && count < MAXLIST; item = strtok(NULL, ","))
+        list[count++] = atoi(item);
+    return count;
+}
+
+long peakMemory() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void printHelp() {
+    printf("Maze benchmark: generates, solves, renders and writes mazes over a sweep of sizes and prints the throughput of each stage,\nthe peak memory use and a checksum of each grid. Every size is measured in its own process.\n\n");
+    printf("options:\n-j <value>\tGenerate in tiles on the specified number of threads\n-n <name>\tName of the scratch output file, default of bench.tiff\n-S <value>\tRandomizer seed, default of 1 so runs can be compared\n\n-algo <name>\tGeneration algorithm (growth, eller, kruskal, wilson or backtracker), default of growth\n-help\t\tPrint this help section\n-res <list>\tComma separated resolutions to render at, default of 1,5\n-sizes <list>\tComma separated maze widths (and heights) to sweep, default of 100,300,1000,3000,10000,20000\n-tile <value>\tTile size used with -j, default of 256\n-workers <value> Number of threads solving and rendering each maze, default of the number of processors\n\n");
+}
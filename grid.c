@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include "grid.h"
+
+/* create grid structure with every cell cleared and return pointer to structure */
+grid *gopen(int wid, int hei) {
+    return gwindow(wid, hei, hei);
+}
+
+/* create grid structure holding the first rows rows with every cell cleared */
+grid *gwindow(int wid, int hei, int rows) {
+    grid *g = malloc(sizeof(grid));
+    g->wid = wid;
+    g->hei = hei;
+    g->stride = (wid + 63) / 64;
+    g->top = 0;
+    g->rows = rows < hei ? rows : hei;
+    if(!(g->bits = calloc((size_t) g->stride * g->rows, sizeof(uint64_t)))) {
+        free(g);
+        return NULL;
+    }
+    return g;
+}
+
+/* slide the window down, rows that stay held move to the front of bits */
+void gslide(grid *g, int top) {
+    int keep = g->top + g->rows - top;
+    size_t words = (size_t) g->stride;
+    if(top <= g->top)
+        return;
+    if(keep < 0)
+        keep = 0;
+    memmove(g->bits, ROW(g,top), sizeof(uint64_t) * words * keep);
+    memset(g->bits + words * keep, 0, sizeof(uint64_t) * words * (g->rows - keep));
+    g->top = top;
+}
+
+/* reuse the memory of g when it has the right size */
+grid *greuse(grid *g, int wid, int hei) {
+    if(g && g->wid == wid && g->hei == hei && g->top == 0 && g->rows == hei) {
+        memset(g->bits, 0, sizeof(uint64_t) * g->stride * hei);
+        return g;
+    }
+    if(g)
+        gclose(g);
+    return gopen(wid, hei);
+}
+
+/* free allocated memory */
+void gclose(grid *g) {
+    free(g->bits);
+    free(g);
+}
+
+/* return the 64 cells of a row starting at column x, which may lie up to 63 columns before the row */
+static uint64_t cellsAt(grid const *g, uint64_t const *row, int x) {
+    if(x < 0)
+        return cellsAt(g, row, 0) << -x;
+    int word = x >> 6;
+    int shift = x & 63;
+    uint64_t cells = row[word] >> shift;
+    if(shift && word + 1 < g->stride)
+        cells |= row[word + 1] << (64 - shift);
+    return cells;
+}
+
+/* OR the wid x hei rectangle of src at (sx, sy) into dst at (dx, dy) one word at a time. Words are updated atomically, so threads can merge rectangles that do not overlap but share words */
+void gmerge(grid *dst, int dx, int dy, grid const *src, int sx, int sy, int wid, int hei) {
+    for(int y = 0; y < hei; ++y) {
+        uint64_t const *from = ROW(src,sy + y);
+        uint64_t *to = ROW(dst,dy + y);
+        for(int x = dx & ~63; x < dx + wid; x += 64) {
+            uint64_t mask = ~(uint64_t) 0;
+            if(x < dx)
+                mask <<= dx - x;
+            if(dx + wid - x < 64)
+                mask &= ~(~(uint64_t) 0 << (dx + wid - x));
+            uint64_t cells = cellsAt(src, from, x - dx + sx) & mask;
+            if(cells)
+                __atomic_fetch_or(to + (x >> 6), cells, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* scan row y one word at a time for the first cell at or after column x that is set (value 1) or cleared (value 0) */
+int gfind(grid const *g, int x, int y, int value) {
+    uint64_t const *row = ROW(g,y);
+    uint64_t flip = value ? 0 : ~(uint64_t) 0;
+    if(x >= g->wid)
+        return g->wid;
+    int word = x >> 6;
+    uint64_t cells = (row[word] ^ flip) & (~(uint64_t) 0 << (x & 63));
+    while(!cells && ++word < g->stride)
+        cells = row[word] ^ flip;
+    if(!cells)
+        return g->wid;
+    x = word * 64 + __builtin_ctzll(cells);
+    return x < g->wid ? x : g->wid;
+}
@@ -0,0 +1,33 @@
+/* This library defines a compact maze grid. Every cell is a single bit (1 = wall, 0 = floor), and each row of cells is stored as a series of 64-bit words.
+ * A grid can hold all of its rows, or only a window of them that a streaming generator slides down the maze. */
+
+#include <stdint.h>
+
+/* cell accessors, these replace indexing an int map with I(W,M,X,Y) */
+#define ROW(G,Y) ((G)->bits + (size_t) ((Y) - (G)->top) * (G)->stride)
+#define GET(G,X,Y) ((int) (ROW(G,Y)[(X) >> 6] >> ((X) & 63) & 1))
+#define SET(G,X,Y) (ROW(G,Y)[(X) >> 6] |= (uint64_t) 1 << ((X) & 63))
+#define CLEAR(G,X,Y) (ROW(G,Y)[(X) >> 6] &= ~((uint64_t) 1 << ((X) & 63)))
+
+typedef struct {
+    int wid; /* number of columns */
+    int hei; /* number of rows */
+    int stride; /* number of 64-bit words per row */
+    int top; /* first row held in bits. Only rows [top, top + rows) can be accessed */
+    int rows; /* number of rows held in bits */
+    uint64_t *bits; /* cell bits, bit x%64 of word x/64 in each row is cell x */
+} grid;
+
+grid *gopen(int wid, int hei); /* creates a grid of the specified size with every cell set to floor */
+
+grid *gwindow(int wid, int hei, int rows); /* creates a grid of the specified size that holds rows rows at a time, starting with row 0 */
+
+void gslide(grid *g, int top); /* moves the window of held rows down to start at row top, keeping the rows that stay held and clearing the new ones */
+
+grid *greuse(grid *g, int wid, int hei); /* returns g with every cell set to floor if it holds all rows of a grid of the specified size, otherwise frees g (if not NULL) and creates a new grid */
+
+void gclose(grid *g); /* frees the allocated memory */
+
+void gmerge(grid *dst, int dx, int dy, grid const *src, int sx, int sy, int wid, int hei); /* ORs a rectangle of cells from src into dst, safe to call from several threads for rectangles that do not overlap */
+
+int gfind(grid const *g, int x, int y, int value); /* returns the first column at or after x in row y whose cell is set (value 1) or floor (value 0), or wid if there is none */
@@ -1,258 +1,605 @@
 #include <stdio.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
-#include "tiff.h"
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include "mazelib.h"
 
-/* index macro */
-#define I(W,M,X,Y) M[(Y)*(W) + (X)]
+/* command line options that are not settings of a maze */
+typedef struct {
+    char *name;
+    char *manifest;
+    int count;
+    int workers;
+    char *serve; /* - to serve standard input, otherwise the path of a Unix socket */
+    int cache; /* number of mazes and of images kept by the server */
+    int stats; /* 1 to print timers and counters after each maze */
+    char *load; /* maze file to draw instead of generating, or NULL */
+    char *save; /* maze file to write instead of an image, or NULL */
+    char *path; /* file to write the cells of the solution to instead of an image, binary if it ends in .bin, or NULL */
+    long long view[4]; /* x, y, width and height of the viewport of an unbounded maze to draw, width 0 for a bounded maze */
+    int chunk; /* cells per side of the chunks of an unbounded maze */
+} options;
 
-#define HEATMAP 1
-#define SOLUTION 2
+/* an encoded maze waiting to be written, data is NULL if it could not be made */
+typedef struct {
+    int job;
+    char *data;
+    size_t length;
+} encoded;
 
-int check(int wid, int hei, int *map, int x, int y, char dir[2]); /* count wall segments forward and sideways from (x,y)*/
-int checkUntilValid(int wid, int hei, int *map, int const pos[2], char dir[2],int direction); /* Check the four possible directions to move, stop at the first available one */
-void drawLines(image *img, int wid, int hei, int *map, int res); /* draw wall lines */
-void generateMaze(int wid, int hei, int *map); /* generate maze */
-void printHelp(); /* print program description and a list of command line options*/
-void rotate(char dir[2], char direction); /* rotate dir by 90 degrees in the specified direction */
-void solveMaze(image *img, int wid, int hei, int *map, uint8_t solve, int res); /* solve maze: trace solution and draw colormap if specified */
+/* batch mode: workers take the mazes in turn, encode each one into memory and queue it for the main thread to write.
+ * The queue is bounded, so workers wait instead of piling up images while the disk falls behind */
+typedef struct {
+    settings *jobs;
+    char **names; /* output file of each maze */
+    int count; /* number of mazes */
+    int next; /* next maze to be made */
+    int working; /* number of workers still running */
+    pthread_mutex_t lock;
+    pthread_cond_t changed; /* signalled whenever the queue or working changes */
+    encoded *queue; /* ring buffer of cap encoded mazes */
+    int cap, head, size;
+    char *failed; /* 1 for each maze that could not be made or written */
+    size_t *lengths; /* length of each written file */
+    stats *stats; /* timers and counters of each maze, NULL unless they are printed */
+} batch;
+
+/* an entry of a server cache, holding a maze or an encoded image */
+typedef struct {
+    settings set;
+    maze *m;
+    char *data;
+    size_t length;
+    unsigned long used; /* request count at the last use */
+} cached;
+
+/* least recently used cache of mazes, or of images */
+typedef struct {
+    cached *entries;
+    int count;
+    int cap;
+    char images; /* 1 if entries are looked up by image, 0 if by maze */
+} lru;
+
+/* server mode: requests are lines holding the options of one maze. Made mazes and encoded images are kept,
+ * so a repeated request is answered from memory and one that only draws a kept maze differently skips generation */
+typedef struct {
+    lru mazes;
+    lru images;
+    unsigned long clock; /* number of requests so far */
+    world *world; /* unbounded maze of the last viewport request, or NULL */
+} server;
+
+cached *evict(lru *c); /* free the least recently used entry if the cache is full, and return an empty one */
+cached *lookup(lru *c, settings const *set, unsigned long now); /* find the entry for settings like set */
+void *makeBatch(void *arg); /* thread body of runBatch, makes mazes until none are left */
+int parseArgs(int argc, char **argv, settings *set, options *opt, FILE *out); /* read command line options, returns 0 on success */
+void printHelp(FILE *out); /* print program description and a list of command line options*/
+void printStats(FILE *out, settings const *set, stats const *st, uint64_t bytes); /* print the timers and counters of a maze as a line of JSON */
+int runBatch(settings const *set, options const *opt); /* make count mazes, or the ones listed in the manifest, on a pool of workers */
+int runServer(settings const *set, options const *opt); /* answer requests from stdin or a Unix socket */
+int sameImage(settings const *a, settings const *b); /* 1 if both settings make the same image */
+char const *tooLarge(settings const *set); /* why the maze of set is too large for its generator, or NULL if it is not */
+void serve(server *s, settings const *defaults, FILE *in, FILE *out); /* answer the requests read from in */
+void writeBatch(batch *b); /* write the mazes queued by the workers of a batch */
 
 int main(int argc, char **argv) {
-    char *name = "maze.tiff";
-    clock_t seed = 0;
-    int wid, hei, res;
-    uint8_t solve = 0;
-    wid = 302;
-    hei = 302;
-    res = 5;
+    settings set = {.wid = 302, .hei = 302, .res = 5, .algo = GROWTH, .tile = TILESIZE};
+    options opt = {"maze.tiff", NULL, 0, sysconf(_SC_NPROCESSORS_ONLN), NULL, 16, 0, NULL, NULL, NULL, {0}, CHUNKSIZE};
+    stats st = {0};
+    struct stat written;
+    if(parseArgs(argc, argv, &set, &opt, stdout))
+        return 1;
+    set.seed = set.seed ? set.seed : (uint64_t) clock();
+    if(opt.serve)
+        return runServer(&set, &opt);
+    if(opt.count > 0 || opt.manifest)
+        return runBatch(&set, &opt);
+
+    set.renderers = opt.workers; /* a single maze is drawn by the workers together */
+    world *w = opt.view[2] ? wopen(set.seed, opt.chunk, CHUNKCACHE) : NULL;
+    if(w && opt.stats)
+        w->stats = &st;
+    maze *m = w ? wview(w, opt.view[0], opt.view[1], opt.view[2], opt.view[3], &set) : opt.load ? mload(opt.load, &set) : mopen(&set);
+    char *name = opt.path ? opt.path : opt.save ? opt.save : opt.name;
+    size_t length = strlen(name);
+    if(!m) {
+        printf("\033[1;31merror: \033[0m Could not read the maze file '%s'.\n", opt.load);
+        return 1;
+    }
+    set = m->set; /* a loaded maze brings its own seed and size */
+    FILE *fp = fopen(name, "w+b"); /* readable too, so mwrite can map it */
+    if(!fp) {
+        printf("\033[1;31merror: \033[0m Could not create '%s'.\n", name);
+        mclose(m);
+        return 1;
+    }
+    if(opt.stats)
+        m->stats = &st;
+    int err;
+    if(opt.path)
+        err = mpath(m, fp, length > 4 && !strcmp(name + length - 4, ".bin"));
+    else
+        err = opt.save ? msave(m, fp) : mwrite(m, fp);
+    mclose(m);
+    if(w)
+        wclose(w);
+    if(err) {
+        printf("\033[1;31merror: \033[0m Could not write '%s'.\n", name);
+        return 1;
+    }
+    printf("%lu\n",set.seed);
+    if(opt.stats)
+        printStats(stdout, &set, &st, stat(name, &written) ? 0 : written.st_size);
+    return 0;
+}
+
+/* read command line options into the settings of a maze and the other options. Messages are printed to out, or left out if it is NULL */
+int parseArgs(int argc, char **argv, settings *set, options *opt, FILE *out) {
+    char const *large;
     for(int i = 1; i < argc; ++i) {
         if(!strcmp("-heatmap",argv[i]))
-            solve |= HEATMAP;
+            set->solve |= HEATMAP;
         else if(!strcmp("-solution",argv[i]))
-            solve |= SOLUTION;
-        else if(!strcmp("-help",argv[i]))
-            printHelp();
+            set->solve |= SOLUTION;
+        else if(!strcmp("-stats",argv[i]))
+            opt->stats = 1;
+        else if(!strcmp("-help",argv[i]) && out)
+            printHelp(out);
+        else if(!strcmp("-strip",argv[i]) && i < argc - 1)
+            set->strip = atoi(argv[++i]);
+        else if(!strcmp("-path",argv[i]) && i < argc - 1)
+            opt->path = argv[++i];
+        else if(!strcmp("-pyramid",argv[i]) && i < argc - 1)
+            set->pyramid = atoi(argv[++i]);
+        else if(!strcmp("-tile",argv[i]) && i < argc - 1)
+            set->tile = atoi(argv[++i]);
+        else if(!strcmp("-count",argv[i]) && i < argc - 1)
+            opt->count = atoi(argv[++i]);
+        else if(!strcmp("-manifest",argv[i]) && i < argc - 1)
+            opt->manifest = argv[++i];
+        else if(!strcmp("-workers",argv[i]) && i < argc - 1)
+            opt->workers = atoi(argv[++i]);
+        else if(!strcmp("-serve",argv[i]) && i < argc - 1)
+            opt->serve = argv[++i];
+        else if(!strcmp("-cache",argv[i]) && i < argc - 1)
+            opt->cache = atoi(argv[++i]);
+        else if(!strcmp("-load",argv[i]) && i < argc - 1)
+            opt->load = argv[++i];
+        else if(!strcmp("-save",argv[i]) && i < argc - 1)
+            opt->save = argv[++i];
+        else if(!strcmp("-viewport",argv[i]) && i < argc - 4) {
+            for(int k = 0; k < 4; ++k)
+                opt->view[k] = atoll(argv[++i]);
+            if(opt->view[2] < 1 || opt->view[3] < 1 || opt->view[2] > INT32_MAX - 2 || opt->view[3] > INT32_MAX - 2) {
+                if(out)
+                    fprintf(out, "\033[1;31merror: \033[0m Viewport dimensions smaller than 1 are invalid.\n");
+                return 1;
+            }
+        }
+        else if(!strcmp("-chunk",argv[i]) && i < argc - 1)
+            opt->chunk = atoi(argv[++i]);
+        else if(!strcmp("-algo",argv[i]) && i < argc - 1) {
+            for(set->algo = ALGORITHMS - 1, ++i; set->algo >= 0 && strcmp(algorithms[set->algo], argv[i]); --set->algo);
+            if(set->algo < 0) {
+                if(out)
+                    fprintf(out, "\033[1;31merror: \033[0m Unknown algorithm '%s'.\n", argv[i]);
+                return 1;
+            }
+        }
         else if(argv[i][0] == '-' && i < argc - 1 && strlen(argv[i]) == 2) {
             switch(argv[i][1]) {
                 case 'S':
-                    seed = atoi(argv[++i]);
+                    set->seed = atoi(argv[++i]);
                     break;
                 case 'w':
-                    wid = atoi(argv[++i]) + 2;
+                    set->wid = atoi(argv[++i]) + 2;
                     break;
                 case 'h':
-                    hei = atoi(argv[++i]) + 2;
+                    set->hei = atoi(argv[++i]) + 2;
                     break;
                 case 'r':
-                    res = atoi(argv[++i]);
+                    set->res = atoi(argv[++i]);
                     break;
                 case 'n':
-                    name = argv[++i];
+                    opt->name = argv[++i];
+                    break;
+                case 'j':
+                    set->threads = atoi(argv[++i]);
 
             }
         }
         else {
-            printf("\033[1;31merror: \033[0mInvalid argument usage: '%s'\n\n",argv[i]);
-            printHelp();
+            if(out) {
+                fprintf(out, "\033[1;31merror: \033[0mInvalid argument usage: '%s'\n\n",argv[i]);
+                printHelp(out);
+            }
             return 1;
         }
 
     }
-    if(wid < 5 || hei < 5) {
-        printf("\033[1;31merror: \033[0m Maze dimensions smaller than 3 are invalid.\n");
+    if(set->wid < 5 || set->hei < 5) {
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Maze dimensions smaller than 3 are invalid.\n");
+        return 1;
+    }
+    if(set->res < 1) {
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Resolutions smaller than 1 are invalid.\n");
+        return 1;
+    }
+    if(!opt->load && ((int64_t) (set->wid - 1) * set->res > INT32_MAX || (int64_t) (set->hei - 1) * set->res > INT32_MAX)) { /* loaded mazes are checked by mwrite */
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Images wider or higher than 2^31 - 1 pixels are invalid.\n");
+        return 1;
+    }
+    if(opt->chunk < 4 || opt->chunk > SIZELIMIT) {
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Chunk sizes must be 4 to %d.\n", SIZELIMIT);
+        return 1;
+    }
+    if(set->pyramid && (set->pyramid < 16 || set->pyramid > TILELIMIT)) { /* a negative size reads as a huge unsigned one */
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Pyramid tiles must be 16 to %d pixels square.\n", TILELIMIT);
+        return 1;
+    }
+    if(set->tile < 3 || set->tile > SIZELIMIT) {
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m Tiles must be 3 to %d.\n", SIZELIMIT);
+        return 1;
+    }
+    if((large = tooLarge(set))) {
+        if(out)
+            fprintf(out, "\033[1;31merror: \033[0m %s.\n", large);
         return 1;
     }
-    image *imp = iopen((wid - 2) * res,(hei - 2) * res, FULLCOLOR);
-    setColor(imp,255,255,255);
-    fillColor(imp);
-    setColor(imp, 0,0,0);
-    int *map = malloc(sizeof(int) * wid * hei);
-    seed = seed ? seed : clock() ;
-
-    srand(seed);
-    generateMaze(wid, hei, map);
-    drawLines(imp, wid, hei, map,res);
-    if(solve)
-        solveMaze(imp,wid,hei,map,solve,res);
-    free(map);
-    setColor(imp,0,0,255);
-    writeFile(imp, name);
-    iclose(imp);
-    printf("%lu\n",seed);
     return 0;
 }
 
-int check(int wid, int hei, int *map, int x, int y, char dir[2]) {
-    if(x >= wid - 1 || x <= 0 || y >= hei - 1 || hei <= 0)
+/* read the mazes of a manifest or number them from set, make them on a pool of workers and print the manifest of what was written */
+int runBatch(settings const *set, options const *opt) {
+    batch b;
+    char line[1024], file[1024];
+    int k, n, failed = 0;
+    unsigned long seed;
+    char const *large;
+    char *name = opt->name;
+    int workers = opt->workers > 0 ? opt->workers : 1;
+    size_t base = strlen(name);
+    FILE *list = NULL;
+    if(opt->save || opt->load || opt->path || opt->view[2]) { /* batches only draw whole generated mazes */
+        printf("\033[1;31merror: \033[0m -save, -load, -path and -viewport cannot be used with -count or -manifest.\n");
         return 1;
-    return I(wid,map,x + dir[0],y + dir[1]) + I(wid,map,x - dir[1],y + dir[0]) + I(wid,map,x + dir[1],y - dir[0]) + I(wid,map,x + dir[0] + dir[1],y + dir[1] + dir[0]) + I(wid,map,x + dir[0] - dir[1],y + dir[1] - dir[0]);;
-}
-
-int checkUntilValid(int wid, int hei, int *map, int const pos[2], char dir[2],int direction) {
-    int a;
-    for(a = 0; a < 4 && check(wid,hei,map,dir[0] + pos[0],dir[1] + pos[1],dir); ++a) {
-        rotate(dir,direction);
     }
-    if(a == 4 || I(wid,map,pos[0] + dir[0],pos[1] + dir[1]))
-        return 0;
-    return a + 1;
-}
-
-/* draw the walls */
-void drawLines(image *img, int wid, int hei, int *map, int res) {
-    int xx, yy;
-    int middle = res / 2;
-    for(int x = wid - 2; x > 0; --x) {
-        for(int y = hei - 2; y > 0; --y) {
-            if(I(wid,map,x,y)) {
-                xx = (x - 1) * res + middle;
-                yy = (y - 1) * res + middle;
-                if(I(wid,map,x+1,y))
-                    orthoLine(img, xx, yy, 0, res);
-                if(I(wid,map,x,y+1))
-                    orthoLine(img, xx, yy, 1, res);
-                if(I(wid,map,x-1,y))
-                    orthoLine(img, xx, yy, 2, res);
-                if(I(wid,map,x,y-1))
-                    orthoLine(img, xx, yy, 3, res);
+    if(base > 5 && !strcmp(name + base - 5, ".tiff"))
+        base -= 5;
+    if(opt->manifest && !(list = fopen(opt->manifest, "r"))) {
+        printf("\033[1;31merror: \033[0m Could not read '%s'.\n", opt->manifest);
+        return 1;
+    }
+    b.count = 0;
+    b.jobs = NULL;
+    b.names = NULL;
+    for(k = 0; list ? fgets(line, sizeof(line), list) != NULL : k < opt->count; ++k) {
+        b.jobs = realloc(b.jobs, sizeof(settings) * (b.count + 1));
+        b.names = realloc(b.names, sizeof(char *) * (b.count + 1));
+        b.jobs[b.count] = *set;
+        b.jobs[b.count].seed = set->seed + k;
+        snprintf(file, sizeof(file), "%.*s-%d.tiff", (int) base, name, b.count);
+        if(list) { /* seed [width height [name]] */
+            if((n = sscanf(line, "%lu %d %d %1023s", &seed, &b.jobs[b.count].wid, &b.jobs[b.count].hei, file)) < 1)
+                continue;
+            b.jobs[b.count].seed = seed;
+            if(n < 3) {
+                b.jobs[b.count].wid = set->wid;
+                b.jobs[b.count].hei = set->hei;
+            }
+            else {
+                b.jobs[b.count].wid += 2;
+                b.jobs[b.count].hei += 2;
+            }
+            if(b.jobs[b.count].wid < 5 || b.jobs[b.count].hei < 5) {
+                printf("\033[1;31merror: \033[0m Maze dimensions smaller than 3 are invalid: '%s'\n", line);
+                continue;
+            }
+            if((int64_t) (b.jobs[b.count].wid - 1) * set->res > INT32_MAX || (int64_t) (b.jobs[b.count].hei - 1) * set->res > INT32_MAX) {
+                printf("\033[1;31merror: \033[0m Images wider or higher than 2^31 - 1 pixels are invalid: '%s'\n", line);
+                continue;
+            }
+            if((large = tooLarge(b.jobs + b.count))) {
+                printf("\033[1;31merror: \033[0m %s: '%s'\n", large, line);
+                continue;
             }
         }
+        b.names[b.count++] = strdup(file);
     }
-}
+    if(list)
+        fclose(list);
 
+    b.next = 0;
+    b.working = workers;
+    b.cap = 2 * workers;
+    b.head = b.size = 0;
+    b.queue = malloc(sizeof(encoded) * b.cap);
+    b.failed = calloc(b.count + 1, 1);
+    b.lengths = calloc(b.count + 1, sizeof(size_t));
+    b.stats = opt->stats ? calloc(b.count + 1, sizeof(stats)) : NULL;
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.changed, NULL);
+    pthread_t *pool = malloc(sizeof(pthread_t) * workers);
+    for(k = 0; k < workers; ++k)
+        pthread_create(pool + k, NULL, makeBatch, &b);
+    writeBatch(&b);
+    for(k = 0; k < workers; ++k)
+        pthread_join(pool[k], NULL);
 
-void generateMaze(int wid, int hei, int *map) {
-    for(int x = wid - 1; x >= 0; --x) {
-        for(int y = hei - 1; y >= 0; --y) {
-            if((x < 2 || y < 2 || x > wid - 3 || y > hei - 3))
-                I(wid,map,x,y) = 1;
-            else
-                I(wid,map,x,y) = 0;
-
+    for(k = 0; k < b.count; ++k) {
+        if(b.failed[k]) {
+            printf("\033[1;31merror: \033[0m Could not write '%s'.\n", b.names[k]);
+            failed = 1;
+        }
+        else {
+            printf("%lu %d %d %s\n", b.jobs[k].seed, b.jobs[k].wid - 2, b.jobs[k].hei - 2, b.names[k]);
+            if(b.stats)
+                printStats(stdout, b.jobs + k, b.stats + k, b.lengths[k]);
         }
+        free(b.names[k]);
     }
-    char dir[2] = {1,0};
-    int pos[2];
-    int iterations = wid*hei / 25;
+    pthread_mutex_destroy(&b.lock);
+    pthread_cond_destroy(&b.changed);
+    free(pool);
+    free(b.queue);
+    free(b.failed);
+    free(b.lengths);
+    free(b.stats);
+    free(b.jobs);
+    free(b.names);
+    return failed;
+}
 
-    /* make paths */
-    int x,y,tmp;
-    int avg;
-    int a;
-    for(int i = 0; i < iterations; ++i) {
-        dir[0] = rand()%3 - 1;
-        dir[1] = dir[0] ? 0 : (rand()%2) * 2 - 1;
-        pos[0] = rand()%(wid - 2) + 1;
-        pos[1] = rand()%(hei - 2) + 1;
-        for(x = 2; x < wid - 2 && checkUntilValid(wid,hei,map,pos,dir,1) == 0; ++x) { /* find a pixel not already occupied by a wall */
-            for(y = 2; y < hei - 2 && checkUntilValid(wid,hei,map,pos,dir,1) == 0; ++y) {
-                pos[1] = (pos[1])%(hei - 2) + 1;
-            }
-            pos[0] = (pos[0])%(wid - 2) + 1;
-        }
-        if(checkUntilValid(wid,hei,map,pos,dir,1) == 0) /* this indicates that the entire map is filled up */
-            return;
-        while(!I(wid,map,pos[0],pos[1])) { /* find the nearest wall */
-            pos[0] += dir[0];
-            pos[1] += dir[1];
+/* worker of a batch, makes mazes into memory and queues them for writing */
+void *makeBatch(void *arg) {
+    batch *b = arg;
+    maze *m = NULL;
+    encoded item;
+    while((item.job = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count) {
+        if(m) /* the grids of the previous maze are reused */
+            mreset(m, b->jobs + item.job);
+        else
+            m = mopen(b->jobs + item.job);
+        m->stats = b->stats ? b->stats + item.job : NULL;
+        mencode(m, &item.data, &item.length);
+        pthread_mutex_lock(&b->lock);
+        while(b->size == b->cap)
+            pthread_cond_wait(&b->changed, &b->lock);
+        b->queue[(b->head + b->size++) % b->cap] = item;
+        pthread_cond_broadcast(&b->changed);
+        pthread_mutex_unlock(&b->lock);
+    }
+    if(m)
+        mclose(m);
+    pthread_mutex_lock(&b->lock);
+    --b->working;
+    pthread_cond_broadcast(&b->changed);
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+/* write the queued mazes to their files until every worker is done */
+void writeBatch(batch *b) {
+    encoded item;
+    FILE *fp;
+    double start;
+    pthread_mutex_lock(&b->lock);
+    while(b->working || b->size) {
+        if(!b->size) {
+            pthread_cond_wait(&b->changed, &b->lock);
+            continue;
         }
-        /* turn around */
-        dir[0] *= -1;
-        dir[1] *= -1;
-        avg = 4;// (wid + hei) / 8;
-        while(2) {
-            if(!(tmp = checkUntilValid(wid,hei,map,pos,dir,2*(rand()%2) - 1)))
-                break;
-            avg -= tmp * 1.5;
-            if(avg < 7)
-                avg = 7;
-            assert(pos[0]+dir[0] < wid);
-            assert(pos[1]+dir[1] < hei);
-            pos[0] += dir[0];
-            pos[1] += dir[1];
-            I(wid,map,pos[0],pos[1]) = 1;
-            if(rand()%avg == 0)
-                rotate(dir,2*(rand()%2) - 1);
+        item = b->queue[b->head];
+        b->head = (b->head + 1) % b->cap;
+        --b->size;
+        pthread_cond_broadcast(&b->changed);
+        pthread_mutex_unlock(&b->lock);
+        start = now();
+        fp = item.data ? fopen(b->names[item.job], "wb") : NULL;
+        b->failed[item.job] = !fp || fwrite(item.data, 1, item.length, fp) != item.length;
+        if(fp && fclose(fp))
+            b->failed[item.job] = 1;
+        b->lengths[item.job] = item.length;
+        if(b->stats) /* the worker is done with them once the maze is queued */
+            b->stats[item.job].write += now() - start;
+        free(item.data);
+        pthread_mutex_lock(&b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* cached images come out the same for settings that make the same maze and draw it the same way */
+int sameImage(settings const *a, settings const *b) {
+    return sameMaze(a, b) && a->res == b->res && a->solve == b->solve && a->strip == b->strip && a->pyramid == b->pyramid;
+}
+
+/* find the entry made for settings like set and mark it used */
+cached *lookup(lru *c, settings const *set, unsigned long now) {
+    for(int k = 0; k < c->count; ++k) {
+        if(c->images ? sameImage(&c->entries[k].set, set) : sameMaze(&c->entries[k].set, set)) {
+            c->entries[k].used = now;
+            return c->entries + k;
         }
-        avg *= 0.9;
-        // printf("\033cGenerating: %.1f\n",(double) i / (double) iterations * 100);
     }
+    return NULL;
 }
 
-void printHelp() {
-    printf("Random Maze generator: This program generates random maze puzzles and draws them into a .tiff file.\nThe user can specify the height, width, and resolution of the maze.\nThe user can also choose to include a step count heatmap or a solution in the image.\nThe program prints the randomizer seed used after completion.\n\n");
-    printf("options:\n-h <value> \tHeight (in wall segments) of maze. Default of 300\n-r <value>\tSpecify resolution (effective pixel width of a floor section), default of 5\n-S <value>\tSpecify andomizer seed default value of clock()\n-w <value>\tWidth (in wall segments) of maze. Default of 300\n");
-    printf("\n-heatmap\tColor floor tiles based on number of steps to get to that tile from the top left corner. Green is lowest, Blue is highest.\n-help\t\tPrint this very helpful help section\n-solution\tTrace the solution to the maze in red\n\n");
+/* return an empty entry, freeing the least recently used one once the cache is full */
+cached *evict(lru *c) {
+    cached *oldest = c->entries;
+    if(c->count < c->cap) {
+        oldest = c->entries + c->count++;
+        oldest->m = NULL;
+        oldest->data = NULL;
+        return oldest;
+    }
+    for(int k = 1; k < c->count; ++k)
+        if(c->entries[k].used < oldest->used)
+            oldest = c->entries + k;
+    if(oldest->m)
+        mclose(oldest->m);
+    free(oldest->data);
+    oldest->m = NULL;
+    oldest->data = NULL;
+    return oldest;
 }
 
-void rotate(char dir[2], char direction) { /* direction: 1 = clockwise, -1 = counterclockwise*/
-    char tmp = dir[0];
-    dir[0] = dir[1] * direction;
-    dir[1] = -tmp * direction;
+char const *tooLarge(settings const *set) {
+    if(set->algo == GROWTH && set->threads == 0 && (size_t) set->wid * set->hei > UINT32_MAX)
+        return "Growth mazes of 2^32 cells or more must be made in tiles with -j";
+    if(set->algo >= KRUSKAL && (int64_t) ((set->wid - 3) / 2) * ((set->hei - 3) / 2) > INT32_MAX)
+        return "Kruskal, wilson and backtracker mazes of 2^31 rooms (about 2^33 cells) or more are invalid";
+    return NULL;
 }
 
-void solveMaze(image *img, int wid, int hei, int *map, uint8_t solve, int res) {
-    I(wid,map,2,2) = -1;
-    int x;
-    int y;
-    int current = -1;
-    int change = 1;
-    int middle = res / 2;
-    while(change /*I(wid,map,wid-3,hei-3) == 0*/) {
-        change = 0;
-        for(x = wid - 2; x > 0; --x) {
-            for(y = hei - 2; y > 0; --y) {
-                if(I(wid,map,x,y) == current) {
-                    if(I(wid,map,x+1,y) == 0) {
-                        I(wid,map,x+1,y) = current - 1;
-                        change = 1;
-                    }
-                    if(I(wid,map,x,y+1) == 0) {
-                        I(wid,map,x,y+1) = current - 1;
-                        change = 1;
-                    }
-                    if(I(wid,map,x-1,y) == 0) {
-                        I(wid,map,x-1,y) = current - 1;
-                        change = 1;
-                    }
-                    if(I(wid,map,x,y-1) == 0) {
-                        I(wid,map,x,y-1) = current - 1;
-                        change = 1;
-                    }
+/* answer the requests read from in until it ends */
+void serve(server *s, settings const *defaults, FILE *in, FILE *out) {
+    char line[4096];
+    char *argv[256];
+    char *save;
+    int argc;
+    settings set;
+    options opt;
+    cached *image, *made;
+    char *data, *view; /* the reply, and the encoded viewport it points to if the request has one */
+    size_t length;
+    FILE *fp;
+    while(fgets(line, sizeof(line), in)) {
+        argv[0] = "serve";
+        for(argc = 1, argv[argc] = strtok_r(line, " \t\r\n", &save); argv[argc] && argc < 255; argv[++argc] = strtok_r(NULL, " \t\r\n", &save));
+        if(argc == 1)
+            continue;
+        set = *defaults;
+        set.seed = 0;
+        opt = (options) {NULL, NULL, 0, 0, NULL, 0, 0, NULL, NULL, NULL, {0}, CHUNKSIZE};
+        if(parseArgs(argc, argv, &set, &opt, NULL)) {
+            fprintf(out, "error invalid request\n");
+            fflush(out);
+            continue;
+        }
+        if(opt.save || opt.load || opt.path || opt.count > 0 || opt.manifest || opt.stats || opt.serve || opt.cache || opt.workers) { /* options of the command line, not of a maze */
+            fprintf(out, "error -save, -load, -path, -count, -manifest, -stats, -serve, -cache and -workers cannot be used in a request\n");
+            fflush(out);
+            continue;
+        }
+        set.seed = set.seed ? set.seed : (uint64_t) clock();
+        view = NULL;
+        if(opt.view[2]) { /* viewports are not kept, the chunks under them are, so they are encoded outside of the image cache */
+            if(s->world && (s->world->seed != set.seed || s->world->size != opt.chunk)) {
+                wclose(s->world);
+                s->world = NULL;
+            }
+            if(!s->world)
+                s->world = wopen(set.seed, opt.chunk, CHUNKCACHE);
+            ++s->clock;
+            maze *m = wview(s->world, opt.view[0], opt.view[1], opt.view[2], opt.view[3], &set);
+            int err = mencode(m, &view, &length);
+            mclose(m);
+            if(err) {
+                fprintf(out, "error could not make the maze\n");
+                fflush(out);
+                continue;
+            }
+            data = view;
+        }
+        else {
+            if(!(image = lookup(&s->images, &set, ++s->clock))) {
+                if((made = lookup(&s->mazes, &set, s->clock))) /* same maze drawn differently, its grid and solution are reused */
+                    mreset(made->m, &set);
+                else {
+                    made = evict(&s->mazes);
+                    made->m = mopen(&set);
+                }
+                made->set = set;
+                made->used = s->clock;
+                image = evict(&s->images);
+                image->set = set;
+                image->used = s->clock;
+                if(mencode(made->m, &image->data, &image->length)) {
+                    image->set.wid = 0; /* matches no request */
+                    fprintf(out, "error could not make the maze\n");
+                    fflush(out);
+                    continue;
                 }
             }
+            data = image->data;
+            length = image->length;
+        }
+        if(!opt.name) {
+            fprintf(out, "image %lu %zu\n", set.seed, length);
+            fwrite(data, 1, length, out);
         }
-        current -= 1;
+        else if(!(fp = fopen(opt.name, "wb")) || fwrite(data, 1, length, fp) != length || fclose(fp))
+            fprintf(out, "error could not write %s\n", opt.name);
+        else
+            fprintf(out, "file %lu %s\n", set.seed, opt.name);
+        fflush(out);
+        free(view);
     }
-    int gradient;
-    for(x = 0; x < wid && (solve & HEATMAP); ++x) {
-        for(y = 0; y < hei; ++y) {
-            if(I(wid,map,x,y) < 0) {
-                gradient = I(wid,map,x,y) * 255 / current;
-                setColor(img, 0, -gradient + 255, gradient);
-                fillRect(img, (x - 1) * res, (y - 1) * res, (x - 1) * res + 2*middle, (y - 1) * res + 2*middle);
-            }
+}
 
+/* serve stdin or the clients of a Unix socket one after another, until the input ends or forever */
+int runServer(settings const *set, options const *opt) {
+    int cap = opt->cache > 0 ? opt->cache : 1;
+    server s = {{calloc(cap, sizeof(cached)), 0, cap, 0}, {calloc(cap, sizeof(cached)), 0, cap, 1}, 0, NULL};
+    struct sockaddr_un address = {0};
+    int listener, client;
+    if(!strcmp(opt->serve, "-")) {
+        serve(&s, set, stdin, stdout);
+        for(lru *c = &s.mazes; c <= &s.images; ++c) {
+            for(int k = 0; k < c->count; ++k) {
+                if(c->entries[k].m)
+                    mclose(c->entries[k].m);
+                free(c->entries[k].data);
+            }
+            free(c->entries);
         }
+        if(s.world)
+            wclose(s.world);
+        return 0;
     }
-    
-    setColor(img,255,0,0);
-    x = wid - 3;
-    y = hei - 3;
-    int tmp,i;
-    char dir[2] = {1,0};
-    while((x != 2 || y != 2) && (solve & SOLUTION)) {
-        dir[0] = 1;
-        dir[1] = 0;
-        for(i = 0; i < 4 && (I(wid,map,x+dir[0],y+dir[1]) > -1 || I(wid,map,x+dir[0],y+dir[1]) <= I(wid,map,x,y)); ++i) {
-            rotate(dir,-1);
-        }
-        // orthoLine(img, (x - 1) * res + middle, (y - 1) * res + middle, i, res);
-        fillRect(img, (x - 1) * res, (y - 1) * res, (x - 1) * res + 2*middle, (y - 1) * res + 2*middle);
-        x += dir[0];
-        y += dir[1];
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, opt->serve, sizeof(address.sun_path) - 1);
+    unlink(opt->serve);
+    if((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) || listen(listener, 16)) {
+        printf("\033[1;31merror: \033[0m Could not listen on '%s'.\n", opt->serve);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); /* clients that hang up early only end their own connection */
+    while(1) {
+        if((client = accept(listener, NULL, NULL)) < 0)
+            continue;
+        FILE *in = fdopen(client, "r");
+        FILE *out = fdopen(dup(client), "w");
+        serve(&s, set, in, out);
+        fclose(in);
+        fclose(out);
     }
-    fillRect(img, res, res, res + 2*middle, res + 2*middle);
-}
\ No newline at end of file
+}
+
+/* one JSON object per maze, so a job runner can collect them line by line */
+void printStats(FILE *out, settings const *set, stats const *st, uint64_t bytes) {
+    fprintf(out, "{\"seed\": %lu, \"width\": %d, \"height\": %d, \"res\": %d, \"algo\": \"%s\", \"threads\": %d, ", (unsigned long) set->seed, set->wid - 2, set->hei - 2, set->res, algorithms[set->algo], set->threads);
+    fprintf(out, "\"seconds\": {\"generate\": %.6f, \"scan\": %.6f, \"grow\": %.6f, \"solve\": %.6f, \"render\": %.6f, \"write\": %.6f}, ", st->generate, st->scan, st->grow, st->solve, st->render, st->write);
+    fprintf(out, "\"counts\": {\"iterations\": %lld, \"grown\": %lld, \"checks\": %lld, \"failed\": %lld, \"levels\": %lld, \"visited\": %lld, \"segments\": %lld, \"rows\": %lld, \"bytes\": %llu}}\n",
+        st->iterations, st->grown, st->checks, st->failed, st->levels, st->visited, st->segments, st->rows, (unsigned long long) bytes);
+}
+
+void printHelp(FILE *out) {
+    fprintf(out, "Random Maze generator: This program generates random maze puzzles and draws them into a .tiff file.\nThe user can specify the height, width, and resolution of the maze.\nThe user can also choose to include a step count heatmap or a solution in the image.\nThe program prints the randomizer seed used after completion.\n\n");
+    fprintf(out, "options:\n-h <value> \tHeight (in wall segments) of maze. Default of 300\n-n <name>\tName of the output file, default of maze.tiff\n-r <value>\tSpecify resolution (effective pixel width of a floor section), default of 5\n-S <value>\tSpecify andomizer seed default value of clock()\n-w <value>\tWidth (in wall segments) of maze. Default of 300\n");
+    fprintf(out, "\n-algo <name>\tGeneration algorithm, growth (default), eller, kruskal, wilson or backtracker. Eller mazes are made one row at a time as the image is written, so their height is only limited by the disk and the 2^31 - 1 pixels images can be wide or high. The last three make perfect mazes on the rooms of eller. -j applies to growth\n-cache <value>\tNumber of mazes and of images kept by -serve, default of 16\n-chunk <value>\tWidth and height (in wall segments) of the chunks of the unbounded maze drawn by -viewport, 4 to 32000, default of 64\n-count <value>\tMake the given number of mazes with seeds counting up from -S, named after -n with their number added, and print a manifest line for each\n-heatmap\tColor floor tiles based on number of steps to get to that tile from the top left corner. Green is lowest, Blue is highest.\n-help\t\tPrint this very helpful help section\n-j <value>\tGenerate the maze in tiles on the specified number of threads. The maze only depends on the seed and tile size, not on the number of threads\n-load <file>\tDraw the maze saved in the file instead of generating one. Its size and seed replace -w, -h and -S, and saved step counts are used for -heatmap and -solution\n-manifest <file> Make the mazes listed in the file, one \"seed [width height [name]]\" per line\n-path <file>\tWrite the cells of the solution from the start (1 1) to the exit instead of drawing the maze, as lines of \"x y\", or in binary if the name ends in .bin\n-pyramid <value> Write the image in tiles of the given number of pixels square (16 to 8192), followed by overviews of half the size each down to a single tile, so viewers can pan and zoom without reading the whole image\n-serve <path>\tServe requests read from the Unix socket at path, or from standard input if path is -. Each line is a request with the options of one maze, the reply is \"image <seed> <length>\" followed by the .tiff file, \"file <seed> <name>\" if the request has -n, or \"error <message>\". Requests cannot use -save, -load, -path, -count, -manifest, -stats, -serve, -cache or -workers\n-save <file>\tWrite the maze to a maze file instead of drawing it, with its step counts if -heatmap or -solution is given\n-solution\tTrace the solution to the maze in red\n-stats\t\tAfter the seed (or each manifest line), print the time spent on each phase and counters of the work done as a line of JSON\n-strip <value>\tNumber of image rows rendered and written at a time, default of about 256 KB worth\n-tile <value>\tWidth and height (in wall segments) of the tiles used with -j, 3 to 32000, default of 256\n-viewport <x> <y> <w> <h> Draw the w by h cells from (x, y) of an unbounded maze instead of a whole maze. Coordinates can be negative, only the chunks under the viewport are made, and it is not solved\n-workers <value> Number of mazes made at once by -count and -manifest, or of threads drawing a single maze, default of the number of processors\n\n");
+}
@@ -0,0 +1,1483 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mazelib.h"
+
+/* index macro for per-cell buffers such as the solver distances */
+#define I(W,M,X,Y) M[(size_t) (Y)*(W) + (X)]
+
+#define BLACK 0 /* palette indices of colored renders, the heatmap gradient follows them */
+#define WHITE 1
+#define RED 2
+#define GRADIENT 3
+
+char const *algorithms[] = {"growth", "eller", "kruskal", "wilson", "backtracker"};
+
+generator *const generators[] = {generateMaze, NULL, generateKruskal, generateWilson, generateBacktracker};
+
+#define MAZEFILE 1 /* version of the maze file format */
+#define PAGE 4096 /* alignment of the sections of a maze file */
+
+/* header of a maze file. The cell bits follow at offset bits, laid out like the rows of a grid, then if they were saved the step counts
+ * of the cells at offset dist, as one int32_t per cell in rows. Both sections start on a page boundary and are used in place from a mapping
+ * of the file, so a band of rows is one range of the file and only the pages that get read are loaded. Values are little endian like the images */
+typedef struct {
+    char magic[4]; /* "MAZE" */
+    uint32_t version;
+    uint64_t seed;
+    int32_t wid, hei; /* including the outer ring of cells */
+    int32_t algo;
+    int32_t threads, tile; /* tiled generation settings, which make a different maze */
+    int32_t stride; /* 64-bit words per row */
+    int32_t longest; /* largest step count, -1 if the step counts are not saved */
+    int32_t unused; /* 0, aligns the offsets */
+    uint64_t bits; /* file offset of the cell bits */
+    uint64_t dist; /* file offset of the step counts, 0 if they are not saved */
+} mazeHeader;
+
+/* tiled generation: the interior is split into tiles separated by one cell thick seam walls.
+ * Every tile opens a single cell of its east or south seam, which joins the tiles into a spanning tree, so the maze stays connected.
+ * The walls inside each tile are then grown independently with an RNG stream derived from the seed and the tile index, which makes the result independent of the number of threads. */
+typedef struct {
+    grid *map;
+    uint64_t seed;
+    int *edges[2]; /* first interior column (row) of each tile column (row), the seam before tile k is at edges[k] - 1 */
+    int count[2]; /* number of tile columns and rows */
+    int *openings[2]; /* row of the opening in the east seam, and column of the opening in the south seam, of each tile. -1 if closed */
+    int next; /* next tile to be grown */
+    int failed; /* 1 if a tile was too large to grow */
+    stats *stats; /* receives the counters of every tile, or NULL */
+    pthread_mutex_t lock; /* guards stats */
+} tiling;
+
+/* a share of the held rows of an image, rasterized by one thread of renderThreaded */
+typedef struct {
+    image view; /* copy of the image with its own current color, drawing into the same rows */
+    scene s; /* copy of the scene counting into counted */
+    stats counted;
+    uint32_t first, last; /* held rows first through last - 1 */
+    pthread_t thread;
+} share;
+
+/* growing list of cells, as cell indices y * wid + x. 32 bits hold the index of any grid of fewer than 2^32 cells at half the memory of size_t,
+ * which matters most to growWalls: its list starts with every wall and gets a cell for each grown one, several times the size of the grid itself */
+typedef struct {
+    int wid;
+    uint32_t *cells;
+    size_t count;
+    size_t cap;
+} cellList;
+
+static void addCell(cellList *l, int x, int y); /* append cell (x,y) to the list */
+static void addStats(stats *to, stats const *from); /* add the timers and counters of from to the ones of to */
+static void buildBorder(grid *map); /* wall off the two outermost rings of cells and clear the rest */
+static int buildRooms(grid *map, int *cols, int *rows); /* wall off every cell but the rooms of the perfect maze algorithms and the dead ends to the exit. Returns -1 without touching the grid if there are 2^31 rooms or more */
+static int checkBorder(grid const *map); /* whether the two outermost rings of cells are all walls, which keeps every search inside the grid */
+static int checkCounts(grid const *map, int32_t const *dist, int32_t longest); /* whether saved step counts fit the cells and their largest count */
+static void countMaze(maze *m); /* count the steps to every cell of a made maze into its step counts */
+static int pad(FILE *fp, long offset); /* write zeros up to the given file offset */
+static void unload(maze *m); /* drop the grid and step counts mapped from a maze file */
+static uint32_t ahead(char const dir[2]); /* bits of nearby() that must be floor to grow from its center in direction dir */
+static int checkUntilValid(grid *map, int const pos[2], char dir[2],int direction); /* Check the four possible directions to move, stop at the first available one */
+static int ellerFlip(eller *e); /* return a random bit */
+static uint32_t nearby(grid const *map, int x, int y); /* the 5 x 5 cells centred on (x,y) as bits */
+static int chunkOpening(world const *w, long long cx, long long cy, int south); /* place of the opening in the east (or south) seam of a chunk */
+static uint64_t chunkStream(long long cx, long long cy); /* RNG stream of a chunk */
+static long long floorDiv(long long a, long long b); /* a / b rounded down */
+static int findSet(int *parent, int label); /* find the root label of the set holding label, compressing the path to it */
+static size_t follow(grid const *map, uint8_t const *from, size_t cell, size_t *route, int reverse); /* store the cells from cell back to the root of its search in route, returns their number */
+static grid *makeChunk(world *w, long long cx, long long cy); /* grow the cells of a chunk */
+static void *growTiles(void *arg); /* thread body of generateTiled, grows tiles until none are left */
+static size_t nextPick(rng *r, size_t count); /* draw the random values of an iteration of growWalls from r, returns the index of the wall it picks out of count */
+static void openPassage(grid *map, int cols, int room, int d); /* clear the wall between a room and its neighbour in direction d of roomStep */
+static void renderRange(image *img, scene const *s, uint32_t first, uint32_t end); /* rasterize held rows first through end - 1 */
+static void *renderShare(void *arg); /* thread body of renderThreaded */
+static void rotate(char dir[2], char direction); /* rotate dir by 90 degrees in the specified direction */
+static int roomExits(int room, int cols, int rows, int exits[4]); /* store the directions of roomStep leading to other rooms, returns their number */
+
+maze *mopen(settings const *set) {
+    maze *m = calloc(1, sizeof(maze));
+    m->set = *set;
+    return m;
+}
+
+/* tiled mazes depend on the tile size, but not on the number of threads */
+int sameMaze(settings const *a, settings const *b) {
+    if(a->seed != b->seed || a->wid != b->wid || a->hei != b->hei || a->algo != b->algo)
+        return 0;
+    if(a->algo != GROWTH || (a->threads == 0 && b->threads == 0))
+        return 1;
+    return a->threads > 0 && b->threads > 0 && a->tile == b->tile;
+}
+
+void mreset(maze *m, settings const *set) {
+    if(!sameMaze(&m->set, set)) {
+        unload(m);
+        m->made = m->counted = m->solved = 0;
+    }
+    m->set = *set;
+}
+
+int mmake(maze *m) {
+    settings const *set = &m->set;
+    int wid = set->wid;
+    int hei = set->hei;
+    eller stream;
+    rng r;
+    double start;
+    int err = 0;
+    if(!m->made) {
+        start = m->stats ? now() : 0;
+        m->map = greuse(m->map, wid, hei);
+        rseed(&r, set->seed, 0);
+        if(set->algo == ELLER) {
+            ellerOpen(&stream, m->map, &r);
+            ellerRows(&stream, 0, hei - 1);
+            ellerClose(&stream);
+        }
+        else if(set->algo == GROWTH && set->threads > 0) {
+            err = generateTiled(m->map, set->seed, set->tile, set->threads, m->stats);
+        }
+        else {
+            err = generators[set->algo](m->map, &r, m->stats);
+        }
+        if(m->stats)
+            m->stats->generate += now() - start;
+        if(err)
+            return -1;
+        m->made = 1;
+        m->counted = m->solved = 0;
+    }
+    if(set->solve && m->counted == 2) { /* step counts that do not fit are dropped and counted again */
+        m->counted = checkCounts(m->map, m->dist, m->longest);
+        if(!m->counted) {
+            m->dist = NULL; /* part of the mapping */
+            m->cells = 0;
+        }
+    }
+    if(set->solve == SOLUTION && !m->counted && m->solved != SOLUTION) { /* the path alone is found without counting the steps to every cell */
+        start = m->stats ? now() : 0;
+        m->path = greuse(m->path, wid, hei);
+        size_t *route, length = findPath(m->map, &route, m->stats);
+        for(size_t k = 0; k < length; ++k)
+            SET(m->path, route[k] % wid, route[k] / wid);
+        SET(m->path, 2, 2); /* the start is always marked */
+        free(route);
+        m->longest = 0; /* only used by the heatmap */
+        m->solved = SOLUTION;
+        if(m->stats)
+            m->stats->solve += now() - start;
+    }
+    else if(set->solve && m->solved != set->solve) {
+        start = m->stats ? now() : 0;
+        if(!m->counted) /* the step counts do not depend on the solve flags, only the path does */
+            countMaze(m);
+        m->path = greuse(m->path, wid, hei);
+        traceSolution(m->map, m->dist, m->path, set->solve);
+        m->solved = set->solve;
+        if(m->stats)
+            m->stats->solve += now() - start;
+    }
+    return 0;
+}
+
+static void countMaze(maze *m) {
+    size_t cells = (size_t) m->set.wid * m->set.hei;
+    if(m->cells < cells) {
+        free(m->dist);
+        m->cells = cells;
+        m->dist = malloc(sizeof(int32_t) * m->cells);
+    }
+    m->longest = countSteps(m->map, m->dist, m->stats);
+    m->counted = 1;
+}
+
+/* render the maze one strip at a time */
+int mwrite(maze *m, FILE *fp) {
+    settings const *set = &m->set;
+    int res = set->res;
+    /* Eller mazes are made as the image is rendered, only the rows under the current strip are held unless the solver needs all of them */
+    int streamed = set->algo == ELLER && !set->solve && !m->made;
+    eller stream;
+    rng r;
+    stats *st = m->stats;
+    double start, rendered;
+    int err;
+    uint32_t width, height;
+    int type = set->solve ? PALETTE : BILEVEL;
+    image *imp = NULL;
+    if((int64_t) (set->wid - 1) * res > INT32_MAX || (int64_t) (set->hei - 1) * res > INT32_MAX) { /* the renderers place pixels with int coordinates */
+        fclose(fp);
+        return -1;
+    }
+    width = (set->wid - 2) * res;
+    height = (set->hei - 2) * res;
+    if(!streamed && mmake(m)) {
+        fclose(fp);
+        return -1;
+    }
+    if(set->pyramid)
+        imp = tsopen(fp, width, height, type, set->pyramid);
+    else if(!set->solve || !(imp = mapopen(fp, width, height, type, set->strip))) /* colored images are not compressed, so they are drawn straight into the file when it can be mapped */
+        imp = fsopen(fp, width, height, type, set->strip);
+    if(!imp)
+        return -1;
+    if(!set->solve) /* plain mazes are black and white, which packs into long runs */
+        imp->compression = PACKBITS;
+    scene view = {NULL, NULL, NULL, 0, {0}, set->solve, res, st};
+    if(streamed) {
+        view.map = gwindow(set->wid, set->hei, imp->rowsPerStrip / res + 4);
+        rseed(&r, set->seed, 0);
+        ellerOpen(&stream, view.map, &r);
+    }
+    else {
+        view.map = m->map;
+        view.dist = m->dist;
+        view.path = m->path;
+        view.longest = m->longest;
+    }
+    if(set->solve)
+        buildPalette(imp, view.longest, view.heat);
+    err = 0;
+    while(imp->top < imp->height && !err) {
+        start = st ? now() : 0;
+        if(streamed) { /* image row py crosses the cell rows (py + res - res / 2) / res and the ones next to it */
+            ellerRows(&stream, (imp->top + res - res / 2) / res - 1, (imp->top + imp->rows - 1 + res - res / 2) / res + 1);
+            if(st) {
+                rendered = now();
+                st->generate += rendered - start;
+                start = rendered;
+            }
+        }
+        renderThreaded(imp, &view, set->renderers);
+        if(st) {
+            rendered = now();
+            st->render += rendered - start;
+        }
+        err = swrite(imp);
+        if(st)
+            st->write += now() - rendered;
+    }
+    if(streamed) {
+        ellerClose(&stream);
+        gclose(view.map);
+    }
+    start = st ? now() : 0;
+    err |= sclose(imp);
+    if(st)
+        st->write += now() - start;
+    return err ? -1 : 0;
+}
+
+int mencode(maze *m, char **data, size_t *length) {
+    FILE *fp = open_memstream(data, length);
+    if(!fp)
+        return -1;
+    if(mwrite(m, fp)) {
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void mclose(maze *m) {
+    unload(m);
+    if(m->map)
+        gclose(m->map);
+    if(m->path)
+        gclose(m->path);
+    free(m->dist);
+    free(m);
+}
+
+/* the grid and step counts of a loaded maze point into the mapping of its file */
+static void unload(maze *m) {
+    if(!m->file)
+        return;
+    free(m->map); /* only the grid structure, its bits are mapped */
+    if(m->dist >= (int32_t *) m->file && m->dist < (int32_t *) ((char *) m->file + m->fileLength)) {
+        m->dist = NULL;
+        m->cells = 0;
+    }
+    munmap(m->file, m->fileLength);
+    m->map = NULL;
+    m->file = NULL;
+}
+
+static int pad(FILE *fp, long offset) {
+    long at = ftell(fp);
+    for(; at >= 0 && at < offset; ++at)
+        if(fputc(0, fp) == EOF)
+            return -1;
+    return at < 0 ? -1 : 0;
+}
+
+int msave(maze *m, FILE *fp) {
+    settings const *set = &m->set;
+    size_t words;
+    mazeHeader head = {{'M', 'A', 'Z', 'E'}, MAZEFILE, set->seed, set->wid, set->hei, set->algo, set->threads, set->tile, 0, -1, 0, 0, 0};
+    int err = 0;
+    double start;
+    if(mmake(m)) {
+        fclose(fp);
+        return -1;
+    }
+    if(set->solve && !m->counted) { /* a maze made for -solution alone has its path but not its step counts */
+        start = m->stats ? now() : 0;
+        countMaze(m);
+        if(m->stats)
+            m->stats->solve += now() - start;
+    }
+    head.stride = m->map->stride;
+    words = (size_t) head.stride * head.hei;
+    head.bits = (sizeof(head) + PAGE - 1) / PAGE * PAGE;
+    if(m->counted) {
+        head.longest = m->longest;
+        head.dist = (head.bits + sizeof(uint64_t) * words + PAGE - 1) / PAGE * PAGE;
+    }
+    err |= fwrite(&head, sizeof(head), 1, fp) != 1;
+    err |= pad(fp, head.bits);
+    err |= fwrite(m->map->bits, sizeof(uint64_t), words, fp) != words;
+    if(m->counted) {
+        err |= pad(fp, head.dist);
+        err |= fwrite(m->dist, sizeof(int32_t), (size_t) head.wid * head.hei, fp) != (size_t) head.wid * head.hei;
+    }
+    err |= fclose(fp) != 0;
+    return err ? -1 : 0;
+}
+
+maze *mload(char *name, settings const *set) {
+    int fd = open(name, O_RDONLY);
+    struct stat info;
+    mazeHeader head;
+    void *file;
+    grid cells;
+    maze *m;
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &info) || (size_t) info.st_size < sizeof(head) || (file = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    close(fd); /* the mapping stays valid */
+    memcpy(&head, file, sizeof(head));
+    /* sections must lie inside the file, at offsets the cells can be read from in place */
+    if(memcmp(head.magic, "MAZE", 4) || head.version != MAZEFILE || head.wid < 5 || head.hei < 5 || head.algo < GROWTH || head.algo >= ALGORITHMS
+            || head.stride != (head.wid + 63) / 64 || head.bits % sizeof(uint64_t) || head.dist % sizeof(int32_t)
+            || head.bits + sizeof(uint64_t) * head.stride * head.hei > (uint64_t) info.st_size
+            || (head.dist && head.dist + sizeof(int32_t) * head.wid * head.hei > (uint64_t) info.st_size)) {
+        munmap(file, info.st_size);
+        return NULL;
+    }
+    cells = (grid) {head.wid, head.hei, head.stride, 0, head.hei, (uint64_t *) ((char *) file + head.bits)};
+    if(!checkBorder(&cells)) {
+        munmap(file, info.st_size);
+        return NULL;
+    }
+    m = mopen(set);
+    m->set.seed = head.seed;
+    m->set.wid = head.wid;
+    m->set.hei = head.hei;
+    m->set.algo = head.algo;
+    m->set.threads = head.threads;
+    m->set.tile = head.tile;
+    m->file = file;
+    m->fileLength = info.st_size;
+    m->map = malloc(sizeof(grid));
+    *m->map = cells;
+    m->made = 1;
+    if(head.dist) { /* checked by mmake when they are first used, so a plain render never reads them */
+        m->dist = (int32_t *) ((char *) file + head.dist);
+        m->cells = (size_t) head.wid * head.hei;
+        m->longest = head.longest;
+        m->counted = 2;
+    }
+    return m;
+}
+
+static int checkBorder(grid const *map) {
+    for(int y = 0; y < map->hei; ++y) {
+        if(y < 2 || y >= map->hei - 2) {
+            if(gfind(map, 0, y, 0) < map->wid)
+                return 0;
+        }
+        else if(!GET(map,0,y) || !GET(map,1,y) || !GET(map,map->wid - 2,y) || !GET(map,map->wid - 1,y))
+            return 0;
+    }
+    return 1;
+}
+
+/* every count must lie in 0 to longest, the border and walls have none, the start has 0 and every other counted cell a neighbour one step closer,
+ * so the solution can be traced back from the exit and the heatmap stays in its gradient */
+static int checkCounts(grid const *map, int32_t const *dist, int32_t longest) {
+    int wid = map->wid;
+    int hei = map->hei;
+    int32_t d, most = -1;
+    if(longest < 0 || I(wid,dist,2,2) != 0)
+        return 0;
+    for(int y = 0; y < hei; ++y) {
+        for(int x = 0; x < wid; ++x) {
+            d = I(wid,dist,x,y);
+            if(d < 0)
+                continue;
+            if(d > longest || x < 2 || y < 2 || x >= wid - 2 || y >= hei - 2 || GET(map,x,y))
+                return 0;
+            if(d == 0 ? x != 2 || y != 2 : I(wid,dist,x - 1,y) != d - 1 && I(wid,dist,x + 1,y) != d - 1 && I(wid,dist,x,y - 1) != d - 1 && I(wid,dist,x,y + 1) != d - 1)
+                return 0;
+            most = d > most ? d : most;
+        }
+    }
+    return most == longest;
+}
+
+int mpath(maze *m, FILE *fp, int binary) {
+    settings const *set = &m->set;
+    size_t *route, length;
+    uint32_t cell[2];
+    int err = 0;
+    double start;
+    if(mmake(m)) {
+        fclose(fp);
+        return -1;
+    }
+    start = m->stats ? now() : 0;
+    length = findPath(m->map, &route, m->stats);
+    if(m->stats)
+        m->stats->solve += now() - start;
+    start = m->stats ? now() : 0;
+    cell[0] = length;
+    if(binary)
+        err |= fwrite(cell, sizeof(uint32_t), 1, fp) != 1;
+    for(size_t k = 0; k < length && !err; ++k) { /* in the cells of the image, which leave out the outer ring */
+        cell[0] = route[k] % set->wid - 1;
+        cell[1] = route[k] / set->wid - 1;
+        if(binary)
+            err |= fwrite(cell, sizeof(uint32_t), 2, fp) != 2;
+        else
+            err |= fprintf(fp, "%u %u\n", cell[0], cell[1]) < 0;
+    }
+    free(route);
+    err |= fclose(fp) != 0;
+    if(m->stats)
+        m->stats->write += now() - start;
+    return err ? -1 : 0;
+}
+
+double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void addStats(stats *to, stats const *from) {
+    to->generate += from->generate;
+    to->scan += from->scan;
+    to->grow += from->grow;
+    to->solve += from->solve;
+    to->render += from->render;
+    to->write += from->write;
+    to->iterations += from->iterations;
+    to->grown += from->grown;
+    to->checks += from->checks;
+    to->failed += from->failed;
+    to->levels += from->levels;
+    to->visited += from->visited;
+    to->segments += from->segments;
+    to->rows += from->rows;
+}
+
+/* bit 5 * (y + 2) + x + 2 is cell (x,y) relative to the center of a nearby() neighbourhood */
+#define NEAR(X,Y) ((uint32_t) 1 << (5 * ((Y) + 2) + (X) + 2))
+
+/* each row of the neighbourhood is cut out of one or two words of the grid. Cells outside the grid count as walls,
+ * so a next cell on the outer ring or beyond it is never free, as it always has a neighbour outside */
+static uint32_t nearby(grid const *map, int x, int y) {
+    uint32_t cells = 0;
+    if(x < 2 || x > map->wid - 3 || y < 2 || y > map->hei - 3) {
+        for(int dy = -2; dy <= 2; ++dy)
+            for(int dx = -2; dx <= 2; ++dx)
+                if(x + dx < 0 || x + dx >= map->wid || y + dy < 0 || y + dy >= map->hei || GET(map,x + dx,y + dy))
+                    cells |= NEAR(dx,dy);
+        return cells;
+    }
+    uint64_t const *row = ROW(map,y - 2) + ((x - 2) >> 6);
+    int shift = (x - 2) & 63;
+    for(int k = 0; k < 25; k += 5, row += map->stride) {
+        uint64_t bits = row[0] >> shift;
+        if(shift > 59)
+            bits |= row[1] << (64 - shift);
+        cells |= (uint32_t) (bits & 31) << k;
+    }
+    return cells;
+}
+
+/* the cell after the next one in direction dir and the cells beside both */
+static uint32_t ahead(char const dir[2]) {
+    int x = dir[0], y = dir[1]; /* the next cell */
+    return NEAR(x + dir[0],y + dir[1]) | NEAR(x - dir[1],y + dir[0]) | NEAR(x + dir[1],y - dir[0]) | NEAR(x + dir[0] + dir[1],y + dir[1] + dir[0]) | NEAR(x + dir[0] - dir[1],y + dir[1] - dir[0]);
+}
+
+/* the neighbourhood is read once and every direction is a mask of it */
+static int checkUntilValid(grid *map, int const pos[2], char dir[2],int direction) {
+    uint32_t cells = nearby(map, pos[0], pos[1]);
+    int a;
+    for(a = 0; a < 4 && cells & ahead(dir); ++a) {
+        rotate(dir,direction);
+    }
+    if(a == 4 || cells & NEAR(dir[0],dir[1]))
+        return 0;
+    return a + 1;
+}
+
+static void buildBorder(grid *map) {
+    int wid = map->wid;
+    int hei = map->hei;
+    for(int x = wid - 1; x >= 0; --x) {
+        for(int y = hei - 1; y >= 0; --y) {
+            if((x < 2 || y < 2 || x > wid - 3 || y > hei - 3))
+                SET(map,x,y);
+            else
+                CLEAR(map,x,y);
+
+        }
+    }
+}
+
+int generateMaze(grid *map, rng *r, stats *st) {
+    buildBorder(map);
+    return growWalls(map, r, st);
+}
+
+static void *growTiles(void *arg) {
+    tiling *t = arg;
+    int tile, tx, ty, w, h;
+    rng r;
+    stats counted = {0}; /* counters of the tiles of this thread, added to the shared ones at the end */
+    while((tile = __atomic_fetch_add(&t->next, 1, __ATOMIC_RELAXED)) < t->count[0] * t->count[1]) {
+        tx = tile % t->count[0];
+        ty = tile / t->count[0];
+        w = t->edges[0][tx + 1] - 1 - t->edges[0][tx];
+        h = t->edges[1][ty + 1] - 1 - t->edges[1][ty];
+        grid *local = gopen(w + 4, h + 4); /* the tile and its surrounding seams, padded like the border of a whole maze */
+        buildBorder(local);
+        if(t->openings[0][tile] >= 0) /* east */
+            CLEAR(local, w + 2, t->openings[0][tile] - t->edges[1][ty] + 2);
+        if(t->openings[1][tile] >= 0) /* south */
+            CLEAR(local, t->openings[1][tile] - t->edges[0][tx] + 2, h + 2);
+        if(tx > 0 && t->openings[0][tile - 1] >= 0) /* west, opened by the tile to the left */
+            CLEAR(local, 1, t->openings[0][tile - 1] - t->edges[1][ty] + 2);
+        if(ty > 0 && t->openings[1][tile - t->count[0]] >= 0) /* north, opened by the tile above */
+            CLEAR(local, t->openings[1][tile - t->count[0]] - t->edges[0][tx] + 2, 1);
+        rseed(&r, t->seed, 2 * (uint64_t) tile);
+        if(growWalls(local, &r, t->stats ? &counted : NULL))
+            __atomic_store_n(&t->failed, 1, __ATOMIC_RELAXED);
+        gmerge(t->map, t->edges[0][tx], t->edges[1][ty], local, 2, 2, w, h);
+        gclose(local);
+    }
+    if(t->stats) {
+        pthread_mutex_lock(&t->lock);
+        addStats(t->stats, &counted);
+        pthread_mutex_unlock(&t->lock);
+    }
+    return NULL;
+}
+
+int generateTiled(grid *map, uint64_t seed, int tile, int threads, stats *st) {
+    tiling t;
+    int size[2] = {map->wid, map->hei};
+    int k, j, x, y;
+    rng r;
+    buildBorder(map);
+    t.map = map;
+    t.seed = seed;
+    t.next = 0;
+    t.failed = 0;
+    t.stats = st;
+    pthread_mutex_init(&t.lock, NULL);
+    for(int a = 0; a < 2; ++a) {
+        /* the interior plus the seam that follows each tile, the last seam is the border */
+        int span = size[a] - 3;
+        t.count[a] = span / (tile + 1) > 0 ? span / (tile + 1) : 1;
+        t.edges[a] = malloc(sizeof(int) * (t.count[a] + 1));
+        for(k = 0; k <= t.count[a]; ++k)
+            t.edges[a][k] = 2 + (int) ((long long) k * span / t.count[a]);
+    }
+    for(k = 1; k < t.count[0]; ++k)
+        for(y = 2; y < map->hei - 2; ++y)
+            SET(map, t.edges[0][k] - 1, y);
+    for(k = 1; k < t.count[1]; ++k)
+        for(x = 2; x < map->wid - 2; ++x)
+            SET(map, x, t.edges[1][k] - 1);
+
+    /* open the seams */
+    t.openings[0] = malloc(sizeof(int) * t.count[0] * t.count[1]);
+    t.openings[1] = malloc(sizeof(int) * t.count[0] * t.count[1]);
+    for(j = 0; j < t.count[1]; ++j) {
+        for(k = 0; k < t.count[0]; ++k) {
+            int i = j * t.count[0] + k;
+            int east = k < t.count[0] - 1;
+            int south = j < t.count[1] - 1;
+            rseed(&r, seed, 2 * (uint64_t) i + 1);
+            if(east && south) {
+                east = rrange(&r, 2);
+                south = !east;
+            }
+            t.openings[0][i] = t.openings[1][i] = -1;
+            if(east) {
+                y = t.edges[1][j] + rrange(&r, t.edges[1][j + 1] - 1 - t.edges[1][j]);
+                t.openings[0][i] = y;
+                CLEAR(map, t.edges[0][k + 1] - 1, y);
+            }
+            if(south) {
+                x = t.edges[0][k] + rrange(&r, t.edges[0][k + 1] - 1 - t.edges[0][k]);
+                t.openings[1][i] = x;
+                CLEAR(map, x, t.edges[1][j + 1] - 1);
+            }
+        }
+    }
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    for(k = 0; k < threads; ++k)
+        pthread_create(workers + k, NULL, growTiles, &t);
+    for(k = 0; k < threads; ++k)
+        pthread_join(workers[k], NULL);
+    free(workers);
+    pthread_mutex_destroy(&t.lock);
+    for(int a = 0; a < 2; ++a) {
+        free(t.edges[a]);
+        free(t.openings[a]);
+    }
+    return t.failed ? -1 : 0;
+}
+
+world *wopen(uint64_t seed, int size, int cache) {
+    world *w = calloc(1, sizeof(world));
+    w->seed = seed;
+    w->size = size;
+    w->cap = cache > 0 ? cache : 1;
+    w->chunks = calloc(w->cap, sizeof(chunk));
+    return w;
+}
+
+void wclose(world *w) {
+    for(int k = 0; k < w->count; ++k)
+        gclose(w->chunks[k].cells);
+    free(w->chunks);
+    free(w);
+}
+
+/* chunk coordinates are 32 bits each */
+static uint64_t chunkStream(long long cx, long long cy) {
+    return (uint64_t) (uint32_t) cx << 32 | (uint32_t) cy;
+}
+
+/* the first two values of the stream of a chunk place its openings, the rest grow its walls */
+static int chunkOpening(world const *w, long long cx, long long cy, int south) {
+    rng r;
+    rseed(&r, w->seed, chunkStream(cx, cy));
+    if(south)
+        rnext(&r);
+    return rrange(&r, w->size - 1);
+}
+
+/* like a tile of generateTiled: the interior and seams are padded like the border of a whole maze, with the openings into the neighbours cleared */
+static grid *makeChunk(world *w, long long cx, long long cy) {
+    int inner = w->size - 1;
+    grid *local = gopen(inner + 4, inner + 4);
+    grid *cells = gopen(w->size, w->size);
+    double start = w->stats ? now() : 0;
+    rng r;
+    buildBorder(local);
+    CLEAR(local, inner + 2, 2 + chunkOpening(w, cx, cy, 0)); /* east */
+    CLEAR(local, 2 + chunkOpening(w, cx, cy, 1), inner + 2); /* south */
+    CLEAR(local, 1, 2 + chunkOpening(w, cx - 1, cy, 0)); /* west, opened by the chunk to the left */
+    CLEAR(local, 2 + chunkOpening(w, cx, cy - 1, 1), 1); /* north, opened by the chunk above */
+    rseed(&r, w->seed, chunkStream(cx, cy));
+    r.counter = 2;
+    growWalls(local, &r, w->stats); /* cannot fail for the chunk sizes wopen takes */
+    gmerge(cells, 0, 0, local, 2, 2, w->size, w->size);
+    gclose(local);
+    if(w->stats)
+        w->stats->generate += now() - start;
+    return cells;
+}
+
+grid *wchunk(world *w, long long cx, long long cy) {
+    chunk *slot = w->chunks;
+    ++w->clock;
+    for(int k = 0; k < w->count; ++k) {
+        if(w->chunks[k].cx == cx && w->chunks[k].cy == cy) {
+            w->chunks[k].used = w->clock;
+            return w->chunks[k].cells;
+        }
+        if(w->chunks[k].used < slot->used)
+            slot = w->chunks + k;
+    }
+    if(w->count < w->cap)
+        slot = w->chunks + w->count++;
+    else
+        gclose(slot->cells);
+    slot->cx = cx;
+    slot->cy = cy;
+    slot->used = w->clock;
+    slot->cells = makeChunk(w, cx, cy);
+    return slot->cells;
+}
+
+static long long floorDiv(long long a, long long b) {
+    return a / b - (a % b < 0);
+}
+
+/* the grid of a viewport has a ring of cells around the cells that are drawn, copied from the chunks under it */
+maze *wview(world *w, long long x, long long y, int wid, int hei, settings const *set) {
+    maze *m = mopen(set);
+    long long left = x - 1, top = y - 1, right = x + wid, bottom = y + hei; /* cells of the grid, inclusive */
+    long long cx, cy, x0, y0, x1, y1;
+    int size = w->size;
+    m->set.seed = w->seed;
+    m->set.wid = wid + 2;
+    m->set.hei = hei + 2;
+    m->set.solve = 0;
+    m->map = gopen(wid + 2, hei + 2);
+    for(cy = floorDiv(top, size); cy <= floorDiv(bottom, size); ++cy) {
+        for(cx = floorDiv(left, size); cx <= floorDiv(right, size); ++cx) {
+            grid *cells = wchunk(w, cx, cy);
+            x0 = cx * size > left ? cx * size : left;
+            y0 = cy * size > top ? cy * size : top;
+            x1 = (cx + 1) * size - 1 < right ? (cx + 1) * size - 1 : right;
+            y1 = (cy + 1) * size - 1 < bottom ? (cy + 1) * size - 1 : bottom;
+            gmerge(m->map, x0 - left, y0 - top, cells, x0 - cx * size, y0 - cy * size, x1 - x0 + 1, y1 - y0 + 1);
+        }
+    }
+    m->made = 1;
+    return m;
+}
+
+/* the perfect maze algorithms join a lattice of rooms into a spanning tree, on the same rooms as Eller's algorithm. Each opened passage is the cell between two rooms */
+static int const roomStep[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+static int buildRooms(grid *map, int *cols, int *rows) {
+    int wid = map->wid;
+    int hei = map->hei;
+    int right, bottom; /* last column and row of rooms */
+    *cols = (wid - 3) / 2;
+    *rows = (hei - 3) / 2;
+    if((int64_t) *cols * *rows > INT32_MAX) /* rooms are counted in int, and walls as 2 * room + 1 in 32 bits */
+        return -1;
+    right = 2 * *cols;
+    bottom = 2 * *rows;
+    for(int y = 0; y < hei; ++y) {
+        uint64_t *row = ROW(map,y);
+        for(int i = 0; i < map->stride; ++i)
+            row[i] = ~(uint64_t) 0;
+        if(wid & 63)
+            row[map->stride - 1] >>= 64 - (wid & 63);
+    }
+    /* an interior an even number of cells wide (tall) has dead ends right of (below) the last rooms, the corner hangs off the dead end right of the last room */
+    for(int y = 2; y <= bottom + 1 && y < hei - 2; ++y) {
+        if(y % 2 && y != bottom + 1) /* passages between rows of rooms are opened by the algorithms */
+            continue;
+        for(int x = 2; x <= right; x += 2)
+            CLEAR(map,x,y);
+        if(right + 1 < wid - 2)
+            CLEAR(map,right + 1,y);
+        if(right + 1 < wid - 2 && y == bottom + 1)
+            SET(map,right,y);
+    }
+    return 0;
+}
+
+static int roomExits(int room, int cols, int rows, int exits[4]) {
+    int x = room % cols;
+    int y = room / cols;
+    int count = 0;
+    for(int d = 0; d < 4; ++d) {
+        int nx = x + roomStep[d][0];
+        int ny = y + roomStep[d][1];
+        if(nx >= 0 && nx < cols && ny >= 0 && ny < rows)
+            exits[count++] = d;
+    }
+    return count;
+}
+
+static void openPassage(grid *map, int cols, int room, int d) {
+    CLEAR(map, 2 + 2 * (room % cols) + roomStep[d][0], 2 + 2 * (room / cols) + roomStep[d][1]);
+}
+
+/* the walls are shuffled up front, then joining them only takes the union-find forest of Eller's algorithm */
+int generateKruskal(grid *map, rng *r, stats *st) {
+    int cols, rows;
+    if(buildRooms(map, &cols, &rows))
+        return -1;
+    int rooms = cols * rows;
+    int *parent = malloc(sizeof(int) * rooms);
+    uint8_t *rank = calloc(rooms, 1); /* bound on the depth of the tree under each root */
+    uint32_t *walls = malloc(sizeof(uint32_t) * 2 * rooms); /* 2 * room for the wall east of a room, 2 * room + 1 for the one south of it */
+    size_t count = 0, k;
+    long long steps = 0, opened = 0;
+    for(int room = 0; room < rooms; ++room) {
+        parent[room] = room;
+        if(room % cols + 1 < cols)
+            walls[count++] = 2 * room;
+        if(room / cols + 1 < rows)
+            walls[count++] = 2 * room + 1;
+    }
+    for(k = count; k > 1; --k) { /* Fisher-Yates shuffle */
+        size_t pick = rnext64(r) % k;
+        uint32_t wall = walls[pick];
+        walls[pick] = walls[k - 1];
+        walls[k - 1] = wall;
+    }
+    for(k = 0; k < count && opened < rooms - 1; ++k) { /* a spanning tree has one passage less than rooms */
+        if(k + 16 < count) /* the rooms of later walls are fetched ahead, as the walls come in random order */
+            __builtin_prefetch(parent + walls[k + 16] / 2);
+        int room = walls[k] / 2;
+        int south = walls[k] & 1;
+        int a = findSet(parent, room);
+        int b = findSet(parent, room + (south ? cols : 1));
+        ++steps;
+        if(a != b) {
+            if(rank[a] < rank[b]) /* the shallower tree goes under the deeper one, which keeps the searches short */
+                parent[a] = b;
+            else {
+                rank[a] += rank[a] == rank[b];
+                parent[b] = a;
+            }
+            openPassage(map, cols, room, south);
+            ++opened;
+        }
+    }
+    free(parent);
+    free(rank);
+    free(walls);
+    if(st) {
+        st->iterations += steps;
+        st->grown += opened;
+    }
+    return 0;
+}
+
+/* each walk remembers only the last way out of every room it crosses, which erases its loops. Following them from the start of the walk
+ * then adds the loop-erased path to the tree. The first walks are long, later ones soon run into the tree */
+int generateWilson(grid *map, rng *r, stats *st) {
+    int cols, rows;
+    int exits[4];
+    if(buildRooms(map, &cols, &rows))
+        return -1;
+    int rooms = cols * rows;
+    char *tree = calloc(rooms, 1); /* 1 for the rooms joined to the maze */
+    uint8_t *out = malloc(rooms); /* direction the walk last left each room in */
+    int const next[4] = {1, cols, -1, -cols}; /* room index offset of each direction */
+    long long steps = 0, opened = 0;
+    tree[0] = 1;
+    for(int start = 1; start < rooms; ++start) {
+        int room = start;
+        int x = start % cols;
+        int y = start / cols;
+        for(; !tree[room]; ++steps) {
+            int d;
+            if(x > 0 && x < cols - 1 && y > 0 && y < rows - 1) /* all four ways lead to rooms */
+                d = rrange(r, 4);
+            else
+                d = exits[rrange(r, roomExits(room, cols, rows, exits))];
+            out[room] = d;
+            room += next[d];
+            x += roomStep[d][0];
+            y += roomStep[d][1];
+        }
+        for(room = start; !tree[room]; room += next[out[room]], ++opened) {
+            tree[room] = 1;
+            openPassage(map, cols, room, out[room]);
+        }
+    }
+    free(tree);
+    free(out);
+    if(st) {
+        st->iterations += steps;
+        st->grown += opened;
+    }
+    return 0;
+}
+
+/* rooms are visited depth first from the start. The stack holds the rooms of the current walk, which backs up to the last room with an unvisited neighbour */
+int generateBacktracker(grid *map, rng *r, stats *st) {
+    int cols, rows;
+    int exits[4];
+    if(buildRooms(map, &cols, &rows))
+        return -1;
+    int rooms = cols * rows;
+    char *seen = calloc(rooms, 1);
+    int *stack = malloc(sizeof(int) * rooms);
+    int const next[4] = {1, cols, -1, -cols};
+    size_t depth = 0;
+    long long steps = 0, opened = 0;
+    stack[depth++] = 0;
+    seen[0] = 1;
+    while(depth) {
+        int room = stack[depth - 1];
+        int count = 0;
+        int all = roomExits(room, cols, rows, exits);
+        for(int k = 0; k < all; ++k) /* keep the ways to unvisited rooms */
+            if(!seen[room + next[exits[k]]])
+                exits[count++] = exits[k];
+        ++steps;
+        if(!count) {
+            --depth;
+            continue;
+        }
+        int d = exits[rrange(r, count)];
+        openPassage(map, cols, room, d);
+        seen[room + next[d]] = 1;
+        stack[depth++] = room + next[d];
+        ++opened;
+    }
+    free(seen);
+    free(stack);
+    if(st) {
+        st->iterations += steps;
+        st->grown += opened;
+    }
+    return 0;
+}
+
+static int findSet(int *parent, int label) {
+    int root = label, next;
+    while(parent[root] != root)
+        root = parent[root];
+    for(; label != root; label = next) {
+        next = parent[label];
+        parent[label] = root;
+    }
+    return root;
+}
+
+void ellerOpen(eller *e, grid *map, rng *r) {
+    e->map = map;
+    e->r = r;
+    e->made = 0;
+    e->left = 0;
+    e->rooms = (map->wid - 3) / 2;
+    e->set = malloc(sizeof(int) * e->rooms);
+    e->parent = malloc(sizeof(int) * e->rooms);
+    e->last = malloc(sizeof(int) * e->rooms);
+    e->down = malloc(e->rooms);
+    e->seen = malloc(e->rooms);
+    for(int i = 0; i < e->rooms; ++i)
+        e->set[i] = e->parent[i] = i;
+}
+
+void ellerClose(eller *e) {
+    free(e->set);
+    free(e->parent);
+    free(e->last);
+    free(e->down);
+    free(e->seen);
+}
+
+static int ellerFlip(eller *e) {
+    int coin;
+    if(!e->left) {
+        e->coins = rnext64(e->r);
+        e->left = 64;
+    }
+    coin = e->coins & 1;
+    e->coins >>= 1;
+    --e->left;
+    return coin;
+}
+
+/* rows of rooms join neighbouring rooms of different sets at random, and all of them on the last row.
+ * The rows between them open at least one room of every set downwards, the rooms below the others start new sets */
+void ellerRow(eller *e) {
+    grid *map = e->map;
+    int wid = map->wid;
+    int n = e->rooms;
+    int y = e->made++;
+    int bottom = 2 * ((map->hei - 3) / 2); /* last row of rooms */
+    int right = 2 * n; /* last column of rooms */
+    int i, k, a, b;
+    uint64_t *row = ROW(map,y);
+    for(i = 0; i < map->stride; ++i)
+        row[i] = ~(uint64_t) 0;
+    if(wid & 63)
+        row[map->stride - 1] >>= 64 - (wid & 63);
+    if(y < 2 || y > bottom + 1 || (y == bottom + 1 && y == map->hei - 2))
+        return;
+    if(y % 2 == 0) {
+        for(i = 0; i < n; ++i)
+            CLEAR(map, 2 + 2 * i, y);
+        if(right + 1 < wid - 2)
+            CLEAR(map, right + 1, y);
+        for(i = 0; i + 1 < n; ++i) {
+            a = findSet(e->parent, e->set[i]);
+            b = findSet(e->parent, e->set[i + 1]);
+            if(a != b && (y == bottom || ellerFlip(e))) {
+                e->parent[b] = a;
+                CLEAR(map, 3 + 2 * i, y);
+            }
+        }
+        return;
+    }
+    if(y == bottom + 1) { /* dead ends below the last rooms, the corner hangs off the dead end right of the last room */
+        for(i = 0; i < n; ++i)
+            CLEAR(map, 2 + 2 * i, y);
+        if(right + 1 < wid - 2) {
+            SET(map, right, y);
+            CLEAR(map, right + 1, y);
+        }
+        return;
+    }
+    memset(e->seen, 0, n);
+    for(i = 0; i < n; ++i) {
+        e->set[i] = findSet(e->parent, e->set[i]);
+        if((e->down[i] = ellerFlip(e)))
+            e->seen[e->set[i]] = 1;
+        e->last[e->set[i]] = i;
+    }
+    for(i = 0; i < n; ++i) {
+        if(!e->seen[e->set[i]]) {
+            e->down[e->last[e->set[i]]] = 1;
+            e->seen[e->set[i]] = 1;
+        }
+    }
+    /* every set keeps a room below it, so there are enough unused labels for the rooms that start over */
+    for(i = 0, k = 0; i < n; ++i) {
+        e->parent[i] = i;
+        if(e->down[i]) {
+            CLEAR(map, 2 + 2 * i, y);
+            continue;
+        }
+        while(e->seen[k])
+            ++k;
+        e->set[i] = k++;
+    }
+}
+
+void ellerRows(eller *e, int first, int last) {
+    grid *map = e->map;
+    int top;
+    if(last >= map->hei)
+        last = map->hei - 1;
+    while(e->made <= last) {
+        if(e->made >= map->top + map->rows) {
+            top = first < e->made ? first : e->made;
+            gslide(map, top > e->made - map->rows + 1 ? top : e->made - map->rows + 1);
+        }
+        ellerRow(e);
+    }
+}
+
+/* remember a wall cell that walls may still grow from */
+static void addCell(cellList *l, int x, int y) {
+    if(l->count == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->cells = realloc(l->cells, sizeof(uint32_t) * l->cap);
+    }
+    l->cells[l->count++] = (uint32_t) y * l->wid + x;
+}
+
+static size_t nextPick(rng *r, size_t count) {
+    if(rrange(r, 3) == 1) /* no horizontal step, the vertical one is drawn */
+        rnext(r);
+    return rnext64(r) % count;
+}
+
+int growWalls(grid *map, rng *r, stats *st) {
+    int wid = map->wid;
+    int hei = map->hei;
+    char dir[2] = {1,0};
+    int pos[2];
+    long long iterations = (long long) wid * hei / 25;
+    cellList g = {wid, NULL, 0, 0}; /* index of the wall cells that new walls may still grow from */
+    long long i, checks = 0, failed = 0, grown = 0; /* counted here and added to st at the end */
+    double start = st ? now() : 0, scanned;
+    if((size_t) wid * hei > UINT32_MAX) /* the cells of the index are 32-bit */
+        return -1;
+
+    /* index every wall that can already be grown from, skipping words without walls */
+    for(int y = 1; y < hei - 1; ++y) {
+        for(int w = 0; w < map->stride; ++w) {
+            for(uint64_t bits = ROW(map,y)[w]; bits; bits &= bits - 1) {
+                pos[0] = w * 64 + __builtin_ctzll(bits);
+                pos[1] = y;
+                ++checks;
+                if(checkUntilValid(map,pos,dir,1))
+                    addCell(&g, pos[0], pos[1]);
+                else
+                    ++failed;
+            }
+        }
+    }
+    scanned = st ? now() : 0;
+
+    /* make paths */
+    int tmp;
+    int avg;
+    size_t pick;
+    for(i = 0; i < iterations && g.count; ++i) {
+        dir[0] = rrange(r, 3) - 1;
+        dir[1] = dir[0] ? 0 : rrange(r, 2) * 2 - 1;
+        pick = rnext64(r) % g.count;
+        pos[0] = g.cells[pick] % wid;
+        pos[1] = g.cells[pick] / wid;
+        /* late in growth most picks fail and each one waits on memory twice, for its entry and then for its rows of the grid.
+         * Fetch the entry of the pick after next and the rows of the next pick early, as they would be if this pick failed */
+        if(g.count > 2) {
+            rng later = *r;
+            size_t next = g.cells[nextPick(&later, g.count - 1)];
+            __builtin_prefetch(g.cells + nextPick(&later, g.count - 2));
+            int x = next % wid, y = next / wid;
+            if(x >= 2 && y >= 2 && y < hei - 2)
+                for(int k = -2; k <= 2; ++k)
+                    __builtin_prefetch(ROW(map,y + k) + ((x - 2) >> 6));
+        }
+        ++checks;
+        if(checkUntilValid(map,pos,dir,1) == 0) { /* walls only ever get added, so a wall that cannot grow now never will */
+            g.cells[pick] = g.cells[--g.count];
+            ++failed;
+            --i;
+            continue;
+        }
+        avg = 4;// (wid + hei) / 8;
+        while(2) {
+            ++checks;
+            if(!(tmp = checkUntilValid(map,pos,dir,2*rrange(r, 2) - 1))) {
+                ++failed;
+                break;
+            }
+            ++grown;
+            avg -= tmp * 1.5;
+            if(avg < 7)
+                avg = 7;
+            assert(pos[0]+dir[0] < wid);
+            assert(pos[1]+dir[1] < hei);
+            pos[0] += dir[0];
+            pos[1] += dir[1];
+            SET(map,pos[0],pos[1]);
+            addCell(&g, pos[0], pos[1]);
+            if(rrange(r, avg) == 0)
+                rotate(dir,2*rrange(r, 2) - 1);
+        }
+        avg *= 0.9;
+        // printf("\033cGenerating: %.1f\n",(double) i / (double) iterations * 100);
+    }
+    free(g.cells);
+    if(st) {
+        st->scan += scanned - start;
+        st->grow += now() - scanned;
+        st->iterations += i;
+        st->grown += grown;
+        st->checks += checks;
+        st->failed += failed;
+    }
+    return 0;
+}
+
+/* rasterize image row py: white first, then the walls crossing it, then the colormap and the solution, each as runs of pixels.
+ * Cell (x,y) is centered on pixel ((x - 1) * res + res / 2, (y - 1) * res + res / 2) and walls are lines between the centers of neighbouring wall cells.
+ * Reachable cells are squares 2 * (res / 2) + 1 pixels wide from ((x - 1) * res, (y - 1) * res), at even resolutions they overlap by a pixel and the later cell in x, then y, wins */
+void renderRow(image *img, scene const *s, int py) {
+    grid *map = s->map;
+    int wid = map->wid;
+    int hei = map->hei;
+    int res = s->res;
+    int middle = res / 2;
+    int y = (py + res - middle) / res; /* last cell row centered at or above py */
+    int x, end, gradient;
+    int32_t d;
+    long long segments = 0;
+    setColor(img, 255, 255, 255);
+    fillSpan(img, 0, img->width - 1, py);
+    setColor(img, 0, 0, 0);
+    if((py + res - middle) % res == 0) { /* through the centers of row y, runs of walls are joined and single walls show where a vertical wall meets them */
+        for(x = gfind(map, 0, y, 1); x < wid; x = gfind(map, end + 1, y, 1)) {
+            end = gfind(map, x, y, 0) - 1;
+            if(end > x)
+                fillSpan(img, (x - 1) * res + middle, (end - 1) * res + middle, py);
+            else if((y > 0 && GET(map,x,y - 1)) || (y < hei - 1 && GET(map,x,y + 1)))
+                setPixel(img, (x - 1) * res + middle, py);
+            else
+                continue;
+            ++segments;
+        }
+    }
+    else if(y < hei - 1) { /* between the centers of rows y and y + 1 only vertical walls cross */
+        uint64_t const *above = ROW(map,y);
+        uint64_t const *below = above + map->stride;
+        for(int w = 0; w < map->stride; ++w)
+            for(uint64_t bits = above[w] & below[w]; bits; bits &= bits - 1, ++segments)
+                setPixel(img, (w * 64 + __builtin_ctzll(bits) - 1) * res + middle, py);
+    }
+    if(s->stats) {
+        s->stats->segments += segments;
+        ++s->stats->rows;
+    }
+    if(!s->solve)
+        return;
+
+    y = py / res + 1; /* cell row whose squares cover py */
+    int overlap = 2 * middle == res && py % res == 0; /* also covered by the squares of row y - 1 */
+    for(x = 1; x < wid - 1 && (s->solve & HEATMAP); ++x) {
+        if((d = I(wid,s->dist,x,y)) < 0 && overlap)
+            d = I(wid,s->dist,x,y - 1);
+        if(d >= 0) {
+            gradient = (int64_t) (d + 1) * 255 / (s->longest + 2);
+            setIndex(img, s->heat[gradient < 254 ? gradient : 254]);
+            fillSpan(img, (x - 1) * res, (x - 1) * res + 2*middle, py);
+        }
+    }
+    setIndex(img, RED);
+    uint64_t const *cells = ROW(s->path,y);
+    uint64_t const *above = cells - s->path->stride;
+    for(int w = 0; w < s->path->stride; ++w) {
+        for(uint64_t bits = cells[w] | (overlap ? above[w] : 0); bits; bits &= bits - 1) {
+            x = w * 64 + __builtin_ctzll(bits);
+            fillSpan(img, (x - 1) * res, (x - 1) * res + 2*middle, py);
+        }
+    }
+}
+
+void renderRows(image *img, scene const *s) {
+    renderRange(img, s, 0, img->rows);
+}
+
+/* image rows that cross the same cells at the same offset come out identical, so they are copied from the row above */
+static void renderRange(image *img, scene const *s, uint32_t first, uint32_t end) {
+    int res = s->res;
+    int middle = res / 2;
+    long long key, last = -1;
+    for(uint32_t row = first; row < end; ++row) {
+        int py = img->top + row;
+        int wall = (py + res - middle) / res;
+        int cell = py / res + 1;
+        key = (((long long) wall * 2 + ((py + res - middle) % res == 0)) * 2 + cell - wall) * 2 + (py % res == 0);
+        if(key == last)
+            memcpy(img->data + row * img->stride, img->data + (row - 1) * img->stride, img->stride);
+        else
+            renderRow(img, s, py);
+        last = key;
+    }
+}
+
+static void *renderShare(void *arg) {
+    share *part = arg;
+    renderRange(&part->view, &part->s, part->first, part->last);
+    return NULL;
+}
+
+/* rows only depend on the scene, so each thread rasterizes a run of them. The threads draw with copies of the image, which keep their own current color */
+void renderThreaded(image *img, scene const *s, int threads) {
+    if(threads > (int) img->rows / 16) /* at least 16 rows each */
+        threads = img->rows / 16;
+    if(threads < 2) {
+        renderRows(img, s);
+        return;
+    }
+    share *parts = malloc(sizeof(share) * threads);
+    for(int k = 0; k < threads; ++k) {
+        parts[k].view = *img;
+        parts[k].s = *s;
+        parts[k].counted = (stats) {0};
+        if(s->stats)
+            parts[k].s.stats = &parts[k].counted;
+        parts[k].first = (uint64_t) img->rows * k / threads;
+        parts[k].last = (uint64_t) img->rows * (k + 1) / threads;
+        pthread_create(&parts[k].thread, NULL, renderShare, parts + k);
+    }
+    for(int k = 0; k < threads; ++k) {
+        pthread_join(parts[k].thread, NULL);
+        if(s->stats)
+            addStats(s->stats, &parts[k].counted);
+    }
+    free(parts);
+}
+
+static void rotate(char dir[2], char direction) { /* direction: 1 = clockwise, -1 = counterclockwise*/
+    char tmp = dir[0];
+    dir[0] = dir[1] * direction;
+    dir[1] = -tmp * direction;
+}
+
+/* the heatmap shades cells with gradient values (steps + 1) * 255 / (longest + 2), drawn as the color (0, 255 - gradient, gradient).
+ * After black, white and red there is room for 253 of the 255 possible values. Shorter mazes use fewer values than that and each gets its own entry,
+ * longer ones share neighbouring values between entries, which is at most one step of 255 away from the exact color */
+void buildPalette(image *img, int longest, uint8_t heat[255]) {
+    uint8_t used[255] = {0};
+    int count = 0;
+    int slot, last = -1;
+    addColor(img, 0, 0, 0);
+    addColor(img, 255, 255, 255);
+    addColor(img, 255, 0, 0);
+    for(int d = 0; d <= longest; ++d)
+        used[(d + 1) * 255 / (longest + 2)] = 1;
+    for(int g = 0; g < 255; ++g)
+        count += used[g];
+    for(int g = 0; g < 255; ++g) {
+        if(count <= 256 - GRADIENT) {
+            heat[g] = used[g] ? addColor(img, 0, 255 - g, g) : GRADIENT;
+            continue;
+        }
+        slot = g * (256 - GRADIENT) / 255;
+        if(slot != last)
+            addColor(img, 0, 255 - g, g);
+        heat[g] = img->colors - 1;
+        last = slot;
+    }
+}
+
+/* breadth first searches from the start and from the exit take turns, each expanding a whole level of the smaller frontier, until they meet.
+ * A cell reached by one search next to a cell of the other lies on a shortest path, since the other search would have reached it first if it were any closer.
+ * Each cell remembers which search reached it and the direction back, so only a byte per cell and the two frontiers are needed */
+size_t findPath(grid *map, size_t **route, stats *st) {
+    int wid = map->wid;
+    size_t cells = (size_t) wid * map->hei;
+    uint8_t *from = calloc(cells, 1); /* 0 if not reached, otherwise 1 + 5 * search + direction back, 4 for the start and exit */
+    size_t *queue[2], count[2] = {1, 1}, head[2] = {0, 0}, cap[2] = {1024, 1024};
+    size_t c, n, end, meet[2] = {0, 0}, length = 0;
+    int const step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    int side, met = 0, x, y;
+    long long levels = 0;
+    for(side = 0; side < 2; ++side) {
+        queue[side] = malloc(sizeof(size_t) * cap[side]);
+        queue[side][0] = side ? (size_t) (map->hei - 3) * wid + wid - 3 : (size_t) 2 * wid + 2;
+    }
+    from[queue[0][0]] = 1 + 4;
+    if(queue[1][0] == queue[0][0]) { /* the smallest maze starts at its exit */
+        met = 1;
+        meet[0] = meet[1] = queue[0][0];
+    }
+    else
+        from[queue[1][0]] = 1 + 5 + 4;
+    while(!met && head[0] < count[0] && head[1] < count[1]) {
+        side = count[0] - head[0] <= count[1] - head[1] ? 0 : 1;
+        for(end = count[side]; head[side] < end && !met; ) {
+            c = queue[side][head[side]++];
+            x = c % wid;
+            y = c / wid;
+            for(int d = 0; d < 4; ++d) {
+                if(GET(map,x + step[d][0],y + step[d][1]))
+                    continue;
+                n = (size_t) (y + step[d][1]) * wid + x + step[d][0];
+                if(from[n] && (from[n] - 1) / 5 != side) {
+                    meet[side] = c;
+                    meet[!side] = n;
+                    met = 1;
+                    break;
+                }
+                if(from[n])
+                    continue;
+                from[n] = 1 + 5 * side + (d + 2) % 4;
+                if(count[side] == cap[side])
+                    queue[side] = realloc(queue[side], sizeof(size_t) * (cap[side] *= 2));
+                queue[side][count[side]++] = n;
+            }
+        }
+        ++levels;
+    }
+    if(st) {
+        st->levels += levels;
+        st->visited += count[0] + count[1];
+    }
+    *route = NULL;
+    if(met) { /* back to the start in reverse, then on to the exit */
+        length = follow(map, from, meet[0], NULL, 0) + (meet[0] != meet[1] ? follow(map, from, meet[1], NULL, 0) : 0);
+        *route = malloc(sizeof(size_t) * length);
+        n = follow(map, from, meet[0], *route, 1);
+        if(meet[0] != meet[1])
+            follow(map, from, meet[1], *route + n, 0);
+    }
+    free(queue[0]);
+    free(queue[1]);
+    free(from);
+    return length;
+}
+
+static size_t follow(grid const *map, uint8_t const *from, size_t cell, size_t *route, int reverse) {
+    int const back[5] = {1, map->wid, -1, -map->wid, 0}; /* index steps of the directions back, none from the start or exit */
+    size_t length = 1, c, k;
+    for(c = cell; (from[c] - 1) % 5 != 4; c += back[(from[c] - 1) % 5])
+        ++length;
+    for(c = cell, k = 0; route && k < length; c += back[(from[c] - 1) % 5], ++k)
+        route[reverse ? length - 1 - k : k] = c;
+    return length;
+}
+
+int solveMaze(grid *map, int32_t *dist, grid *path, uint8_t solve, stats *st) {
+    int longest = countSteps(map, dist, st);
+    traceSolution(map, dist, path, solve);
+    return longest;
+}
+
+int countSteps(grid *map, int32_t *dist, stats *st) {
+    int wid = map->wid;
+    int hei = map->hei;
+    size_t cap = 1024; /* BFS frontier ring buffer of cell indices, doubled whenever it fills up */
+    size_t *queue = malloc(sizeof(size_t) * cap);
+    size_t head = 0, tail = 0, c;
+    int x;
+    int y;
+    int nx, ny;
+    int longest = 0;
+    int const step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    memset(dist, 0xff, sizeof(int32_t) * wid * hei); /* -1 */
+    I(wid,dist,2,2) = 0;
+    queue[tail++] = 2 * wid + 2;
+    while(head < tail) {
+        c = queue[head++ & (cap - 1)];
+        x = c % wid;
+        y = c / wid;
+        longest = dist[c];
+        for(int d = 0; d < 4; ++d) {
+            nx = x + step[d][0];
+            ny = y + step[d][1];
+            if(!GET(map,nx,ny) && I(wid,dist,nx,ny) < 0) {
+                I(wid,dist,nx,ny) = longest + 1;
+                if(tail - head == cap) {
+                    size_t *grown = malloc(sizeof(size_t) * cap * 2);
+                    for(c = head; c < tail; ++c)
+                        grown[c & (2 * cap - 1)] = queue[c & (cap - 1)];
+                    free(queue);
+                    queue = grown;
+                    cap *= 2;
+                }
+                queue[tail++ & (cap - 1)] = (size_t) ny * wid + nx;
+            }
+        }
+    }
+    free(queue);
+    if(st) { /* every reachable cell went through the queue once */
+        st->levels += longest + 1;
+        st->visited += tail;
+    }
+    return longest;
+}
+
+/* walk from the exit to the start, always stepping to a neighbour with a smaller step count */
+void traceSolution(grid *map, int32_t const *dist, grid *path, uint8_t solve) {
+    int wid = map->wid;
+    int x = wid - 3;
+    int y = map->hei - 3;
+    int i;
+    char dir[2] = {1,0};
+    if(I(wid,dist,x,y) < 0) /* the exit cannot be reached, there is no solution to trace */
+        solve &= ~SOLUTION;
+    while((x != 2 || y != 2) && (solve & SOLUTION)) {
+        dir[0] = 1;
+        dir[1] = 0;
+        for(i = 0; i < 4 && (I(wid,dist,x+dir[0],y+dir[1]) < 0 || I(wid,dist,x+dir[0],y+dir[1]) >= I(wid,dist,x,y)); ++i) {
+            rotate(dir,-1);
+        }
+        SET(path,x,y);
+        x += dir[0];
+        y += dir[1];
+    }
+    SET(path,2,2); /* the start is always marked */
+}
@@ -0,0 +1,192 @@
+/* This library generates, solves and draws mazes. It keeps no global state: a maze context holds the settings, grid and solution of one maze,
+ * and every other function works on the grids and images passed to it, so mazes can be made on any number of threads at once.
+ * Mazes are written as .tiff files, or encoded into memory with mencode. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tiff.h"
+#include "grid.h"
+#include "rng.h"
+
+#define HEATMAP 1
+#define SOLUTION 2
+
+#define TILESIZE 256 /* default width and height of the tiles used by tiled generation */
+#define CHUNKSIZE 64 /* default width and height of the chunks of an unbounded maze */
+#define CHUNKCACHE 4096 /* default number of chunks kept by an unbounded maze */
+#define SIZELIMIT 32000 /* largest tile and chunk size. Tiles are up to twice as wide, so their grids stay under the 2^32 cells growWalls can index */
+
+#define GROWTH 0 /* generation algorithms, in the order of their names in algorithms */
+#define ELLER 1
+#define KRUSKAL 2
+#define WILSON 3
+#define BACKTRACKER 4
+#define ALGORITHMS 5 /* number of generation algorithms */
+
+extern char const *algorithms[]; /* names of the generation algorithms */
+
+/* settings of one maze */
+typedef struct {
+    uint64_t seed;
+    int wid, hei, res; /* width and height include the outer ring of cells */
+    uint8_t solve;
+    int algo;
+    int threads; /* threads of tiled generation, 0 to grow the maze as a whole */
+    int tile;
+    uint32_t strip; /* image rows per strip, 0 for the default */
+    uint32_t pyramid; /* pixel width and length of the tiles of a tiled image with overviews, 0 to write strips */
+    int renderers; /* threads rasterizing each strip or row of tiles, 0 for one */
+} settings;
+
+/* timers and counters of the work done on a maze, collected when the maze context points at one. Times are in seconds and add up over threads */
+typedef struct {
+    double generate; /* making the grid, scan and grow are part of it */
+    double scan; /* indexing the walls that can grow */
+    double grow; /* growing walls from the index */
+    double solve; /* step counts and solution */
+    double render; /* rasterizing image rows */
+    double write; /* encoding and writing strips and the file directory */
+    long long iterations; /* walls started by wall growth, or steps taken by the perfect maze algorithms */
+    long long grown; /* wall cells added by wall growth, or passages opened between rooms */
+    long long checks; /* checkUntilValid calls */
+    long long failed; /* checks that found no direction to grow in */
+    long long levels; /* BFS levels, the largest step count plus one */
+    long long visited; /* cells reached by BFS */
+    long long segments; /* wall runs and single wall pixels drawn */
+    long long rows; /* image rows rasterized, the others are copies of the row above */
+} stats;
+
+typedef int generator(grid *map, rng *r, stats *st); /* fills map with a maze drawn from r, counting the work in st unless it is NULL. Returns 0 on success, -1 if map is too large for it */
+
+extern generator *const generators[]; /* generator of each algorithm. Eller's is made by rows instead and has none */
+
+/* a maze and what is known about it. The grid and solution are made when first needed and kept for later writes */
+typedef struct {
+    settings set;
+    grid *map; /* grid of the maze, NULL until it is made */
+    int made; /* 1 if map holds the maze of set */
+    grid *path; /* cells of the solution */
+    int32_t *dist; /* steps from the start to each cell, -1 where unreachable */
+    size_t cells; /* number of cells dist has room for */
+    int longest; /* largest step count */
+    uint8_t counted; /* 1 if dist holds the step counts of map, 2 if they were loaded from a file and are not checked yet */
+    uint8_t solved; /* solve flags that path was made for, 0 if it was not */
+    stats *stats; /* receives timers and counters of the work done, NULL to skip them */
+    void *file; /* mapping of the maze file that map (and dist if it was saved) point into, NULL unless loaded */
+    size_t fileLength;
+} maze;
+
+/* a chunk of an unbounded maze */
+typedef struct {
+    long long cx, cy; /* chunk coordinates, the chunk covers cells [cx * size, (cx + 1) * size) by [cy * size, (cy + 1) * size) */
+    grid *cells;
+    unsigned long used; /* request count at the last use */
+} chunk;
+
+/* an unbounded maze made of square chunks, each made on its own from the seed and its coordinates, so any rectangle of the maze
+ * can be drawn by making only the chunks under it. The last column and row of each chunk are seams with one opening each,
+ * at a place picked from the chunk's stream, so every chunk connects to its four neighbours. Chunks are kept in a least recently used cache.
+ * Not safe to use from several threads at once */
+typedef struct {
+    uint64_t seed;
+    int size; /* cells per side of a chunk, seams included */
+    chunk *chunks;
+    int count, cap; /* number of chunks held and kept at most */
+    unsigned long clock; /* number of chunk requests so far */
+    stats *stats; /* receives the generation timers and counters, or NULL */
+} world;
+
+/* row-streaming generation with Eller's algorithm. Rooms sit on the cells (2 + 2i, 2 + 2j) and are joined by opening the cells between them.
+ * The maze is made one grid row at a time, remembering only the set of connected rooms each room of the current row belongs to, so any height takes O(width) memory.
+ * When the interior is an even number of cells wide (tall) its last column (row) holds dead ends off the last rooms, which keeps the exit reachable */
+typedef struct {
+    grid *map; /* receives the rows, usually a window of them */
+    rng *r;
+    int made; /* number of grid rows made so far */
+    int rooms; /* number of rooms in a row */
+    int *set; /* set label of each room in the current row */
+    int *parent; /* union-find forest over the labels, the root of a tree labels the merged set */
+    int *last; /* last room of each set in the current row */
+    char *down; /* 1 for each room that opens into the row below */
+    char *seen; /* 1 for each label that already has a room opening down */
+    uint64_t coins; /* random bits for the joins, drawn 64 at a time */
+    int left; /* number of bits left in coins */
+} eller;
+
+/* what gets drawn: the maze, and for colored renders the solver results */
+typedef struct {
+    grid *map;
+    int32_t *dist; /* steps from the start to each cell, -1 where unreachable */
+    grid *path; /* cells of the solution */
+    int longest; /* largest step count */
+    uint8_t heat[255]; /* palette index of each heatmap gradient value */
+    uint8_t solve;
+    int res;
+    stats *stats; /* receives the drawing counters, or NULL */
+} scene;
+
+maze *mopen(settings const *set); /* creates a maze context for the given settings. Nothing is made until it is needed */
+
+void mreset(maze *m, settings const *set); /* changes the settings of m. The grid and solution are kept if they still apply, otherwise their memory is reused */
+
+int mmake(maze *m); /* makes the grid, and the solution if the settings draw one. Returns 0 on success, -1 if the maze is too large for its generator */
+
+int mwrite(maze *m, FILE *fp); /* streams the image of the maze to fp and closes it, making the maze first if needed. Returns 0 on success, -1 on failure or if the image would be over 2^31 - 1 pixels wide or high */
+
+int mencode(maze *m, char **data, size_t *length); /* same as mwrite, but into a buffer allocated with malloc that the caller frees */
+
+void mclose(maze *m); /* frees the allocated memory */
+
+int msave(maze *m, FILE *fp); /* writes the maze to fp as a maze file and closes it, making the maze first if needed. The step counts are saved too if the settings solve the maze. Returns 0 on success */
+
+maze *mload(char *name, settings const *set); /* maps the maze file with the given name into a maze context with the drawing settings of set, NULL if it cannot be read or its outer two rings of cells are not all walls */
+
+world *wopen(uint64_t seed, int size, int cache); /* creates an unbounded maze with chunks of size cells per side (4 to SIZELIMIT), keeping up to cache chunks */
+
+grid *wchunk(world *w, long long cx, long long cy); /* returns the cells of a chunk, made unless it is cached. They stay valid until the next request for a chunk */
+
+maze *wview(world *w, long long x, long long y, int wid, int hei, settings const *set); /* creates a maze context holding the wid x hei cells from (x, y) on, ready for mwrite or mencode with the drawing settings of set. Viewports are not solved */
+
+void wclose(world *w); /* frees the allocated memory */
+
+int mpath(maze *m, FILE *fp, int binary); /* writes the image cells of the solution from the start (1,1) to the exit to fp and closes it, making the maze first if needed. Text has a line "x y" per cell, binary the number of cells and x, y of each as uint32_t. Returns 0 on success */
+
+int sameMaze(settings const *a, settings const *b); /* 1 if both settings make the same grid */
+
+void buildPalette(image *img, int longest, uint8_t heat[255]); /* fill the palette of a colored render and map each heatmap gradient value to a palette index */
+
+int countSteps(grid *map, int32_t *dist, stats *st); /* count the steps from the start to every cell, -1 where unreachable, and return the largest count */
+
+void ellerClose(eller *e); /* free the row state of Eller generation */
+
+void ellerOpen(eller *e, grid *map, rng *r); /* start Eller generation into map */
+
+void ellerRow(eller *e); /* make the next grid row */
+
+void ellerRows(eller *e, int first, int last); /* make the rows up to last and slide the window of map to hold rows first through last */
+
+size_t findPath(grid *map, size_t **route, stats *st); /* find a shortest path from the start to the exit with a bidirectional search. Stores its cell indices y * wid + x in order in *route, allocated with malloc, and returns their number, 0 if there is none */
+
+int generateBacktracker(grid *map, rng *r, stats *st); /* perfect maze from a depth-first walk that backs up along an explicit stack of rooms when it is stuck. Returns -1 if there are 2^31 rooms or more */
+
+int generateKruskal(grid *map, rng *r, stats *st); /* perfect maze from opening the walls between rooms in a random order unless it makes a loop. Returns -1 if there are 2^31 rooms or more */
+
+int generateMaze(grid *map, rng *r, stats *st); /* generate maze, counting the work in st unless it is NULL. Returns -1 if the grid has 2^32 cells or more */
+
+int generateTiled(grid *map, uint64_t seed, int tile, int threads, stats *st); /* generate maze in separately grown tiles on the given number of threads. Returns -1 if a tile has 2^32 cells or more */
+
+int generateWilson(grid *map, rng *r, stats *st); /* perfect maze drawn uniformly from all spanning trees of the rooms, joined by loop-erased random walks. Returns -1 if there are 2^31 rooms or more */
+
+int growWalls(grid *map, rng *r, stats *st); /* grow random walls out of the existing ones until the maze is filled. Returns -1 without growing if the grid has 2^32 cells or more */
+
+double now(); /* monotonic time in seconds */
+
+void renderRow(image *img, scene const *s, int py); /* rasterize image row py of the scene */
+
+void renderRows(image *img, scene const *s); /* rasterize the rows held by img */
+
+void renderThreaded(image *img, scene const *s, int threads); /* same as renderRows, shared between the given number of threads */
+
+int solveMaze(grid *map, int32_t *dist, grid *path, uint8_t solve, stats *st); /* solve maze: count steps to every cell and mark the solution in path, returns the largest step count */
+
+void traceSolution(grid *map, int32_t const *dist, grid *path, uint8_t solve); /* mark the shortest path from the start to the exit in path if solve has SOLUTION, and the start in any case */
@@ -0,0 +1,26 @@
+#include "rng.h"
+
+/* SplitMix64 finalizer: a fast bijective 64 bit hash */
+static uint64_t mix(uint64_t z) {
+    z += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void rseed(rng *r, uint64_t seed, uint64_t stream) {
+    r->key = mix(seed ^ mix(stream));
+    r->counter = 0;
+}
+
+uint32_t rnext(rng *r) {
+    return mix(r->key + r->counter++ * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+uint64_t rnext64(rng *r) {
+    return mix(r->key + r->counter++ * 0x9E3779B97F4A7C15ull);
+}
+
+int rrange(rng *r, int n) {
+    return rnext(r) % n;
+}
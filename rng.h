@@ -0,0 +1,17 @@
+/* This library defines a counter-based random number generator. Each output is a hash of a key and the output's position in its stream.
+ * The key is derived from a seed and a stream number, so independent streams (one per tile, per maze...) can be drawn from any thread and reproduced exactly. */
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t key; /* hash of the seed and stream number */
+    uint64_t counter; /* number of values drawn so far */
+} rng;
+
+void rseed(rng *r, uint64_t seed, uint64_t stream); /* start the given stream of the given seed */
+
+uint32_t rnext(rng *r); /* return the next 32 bit value of the stream */
+
+int rrange(rng *r, int n); /* return the next value of the stream reduced to the range [0, n) */
+
+uint64_t rnext64(rng *r); /* return the next 64 bit value of the stream */
@@ -1,79 +1,150 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define SETCOLOR(IMG,R,G,B) { IMG->color[0] = R; IMG->color[1] = G; IMG->color[2] = B; }
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tiff.h"
 
 #define BYTE     1
 #define ASCII    2
 #define SHORT    3
 #define LONG     4
 #define RATIONAL 5
+#define LONG8    16 /* BigTIFF only */
 
-#define GRAYSCALE 1
-#define FULLCOLOR 3
-
-typedef struct {
-    uint16_t width;
-    uint16_t height;
-    uint8_t color[3];
-    uint8_t *data;
-    uint32_t datlen;
-    uint8_t bytesPerPixel;
-    char type;
-} image;
+#define STRIPSIZE 262144 /* default number of bytes per strip */
+#define CLASSICLIMIT 0xFFFFFFFFu /* largest offset a classic TIFF file can hold */
 
 void setColor(image *img, uint8_t r, uint8_t g, uint8_t b) {
     SETCOLOR(img,r,g,b);
+    if(img->type != PALETTE)
+        return;
+    int best = 0, error, bestError = 3 * 255 * 255 + 1;
+    for(int i = 0; i < img->colors; ++i) {
+        int dr = img->palette[i][0] - r, dg = img->palette[i][1] - g, db = img->palette[i][2] - b;
+        if((error = dr * dr + dg * dg + db * db) < bestError) {
+            best = i;
+            bestError = error;
+        }
+    }
+    img->index = best;
+}
+
+void setIndex(image *img, uint8_t index) {
+    memcpy(img->color, img->palette[index], 3);
+    img->index = index;
+}
+
+int addColor(image *img, uint8_t r, uint8_t g, uint8_t b) {
+    if(img->colors == 256)
+        return -1;
+    img->palette[img->colors][0] = r;
+    img->palette[img->colors][1] = g;
+    img->palette[img->colors][2] = b;
+    return img->colors++;
 }
 
-/* fills image with current color */
+/* 1 if the current color is drawn as white in a bilevel image */
+static int white(image *img) {
+    return img->color[0] + img->color[1] + img->color[2] >= 384;
+}
+
+/* set pixel x of held row row to the current color */
+static void paint(image *img, int x, int row) {
+    uint8_t *line = img->data + (size_t) row * img->stride;
+    if(img->type == BILEVEL) {
+        if(white(img))
+            line[x >> 3] |= 0x80 >> (x & 7);
+        else
+            line[x >> 3] &= ~(0x80 >> (x & 7));
+    }
+    else if(img->type == PALETTE)
+        line[x] = img->index;
+    else
+        memcpy(line + (size_t) x * img->bytesPerPixel, img->color, img->bytesPerPixel);
+}
+
+/* fills held rows with current color */
 void fillColor(image *img) {
-    for(uint32_t i = 0; i < img->datlen; i += img->bytesPerPixel) {
-        memcpy(img->data + i, img->color, img->bytesPerPixel);
+    for(uint32_t y = 0; y < img->rows; ++y)
+        fillSpan(img, 0, img->width - 1, img->top + y);
+}
+
+/* set pixels x1 through x2 of row y to the current color. Whole bytes are filled with memset, and RGB pixels by doubling the filled run */
+void fillSpan(image *img, int x1, int x2, int y) {
+    if(x1 < 0)
+        x1 = 0;
+    if(x2 >= (int) img->width)
+        x2 = img->width - 1;
+    if(x1 > x2 || y < (int) img->top || y >= (int) (img->top + img->rows))
+        return;
+    uint8_t *line = img->data + (size_t) (y - img->top) * img->stride;
+    size_t n = x2 - x1 + 1;
+    if(img->type == BILEVEL) {
+        uint8_t fill = white(img) ? 0xFF : 0;
+        uint8_t first = 0xFF >> (x1 & 7), last = 0xFF << (7 - (x2 & 7));
+        if(x1 >> 3 == x2 >> 3)
+            first &= last;
+        line[x1 >> 3] = (line[x1 >> 3] & ~first) | (fill & first);
+        if(x1 >> 3 == x2 >> 3)
+            return;
+        memset(line + (x1 >> 3) + 1, fill, (x2 >> 3) - (x1 >> 3) - 1);
+        line[x2 >> 3] = (line[x2 >> 3] & ~last) | (fill & last);
+    }
+    else if(img->type == PALETTE)
+        memset(line + x1, img->index, n);
+    else if(img->bytesPerPixel == 1)
+        memset(line + x1, img->color[0], n);
+    else {
+        uint8_t *start = line + (size_t) x1 * img->bytesPerPixel;
+        size_t done = img->bytesPerPixel, total = n * img->bytesPerPixel;
+        memcpy(start, img->color, done);
+        for(; done < total; done *= 2)
+            memcpy(start + done, start, done * 2 <= total ? done : total - done);
     }
 }
 
 /* set given pixel to current color. */
 void setPixel(image *img, int x, int y) {
-    if(x >= 0 && x < img->width && y >= 0 && y < img->height) {
-        uint32_t index = (y * img->width + x) * img->bytesPerPixel;
-        memcpy(img->data + index, img->color, img->bytesPerPixel);
-    }
+    if(x >= 0 && x < (int) img->width && y >= (int) img->top && y < (int) (img->top + img->rows))
+        paint(img, x, y - img->top);
 }
 
 /* same as setPixel, but it does not protect against bad (x, y) pairs */
 void unsafeSetPixel(image *img, int x, int y) {
-    uint32_t index = (y * img->width + x) * img->bytesPerPixel;
-    memcpy(img->data + index, img->color, img->bytesPerPixel);
+    paint(img, x, y - img->top);
 }
 
 /* draws orthogonal line (vertical or horizontal), of length (int) len, starting at (x, y), moving in direction dir */
 /* dir = 0: right, dir = 1: numerically up (visually down), dir = 3: left, dir = 4: numerically down (visually up)  */
 void orthoLine(image *img, int x, int y, char dir, int len) {
     int direction[2] = {((dir + 1)%2), (dir%2)};
+    int top = img->top;
+    int bottom = img->top + img->rows;
     dir = -(2 * ((dir/2)%2) - 1);
     direction[0] *= dir;
     direction[1] *= dir;
-    if(direction[0] == 0 && (x < 0 || x >= img->width)) /* vertical line */
+    if(direction[0] == 0 && (x < 0 || x >= (int) img->width)) /* vertical line */
         return;
-    if(direction[1] == 0 && (y < 0 || y >= img->width)) /* horizontal line */
+    if(direction[1] == 0 && (y < top || y >= bottom)) /* horizontal line */
         return;
     int start = direction[0] ? x : y;
-    int limit = direction[0] ? img->width : img->height;
-    uint32_t index;
+    int first = direction[0] ? 0 : top;
+    int limit = direction[0] ? (int) img->width : bottom;
     for(; len >= 0; --len) {
-        if(start + len * dir < limit && start + len * dir >= 0) {
-            index = ((y + len * direction[1]) * img->width + x + len * direction[0]) * img->bytesPerPixel;
-            memcpy(img->data + index, img->color, img->bytesPerPixel);
-
-        }
+        if(start + len * dir < limit && start + len * dir >= first)
+            paint(img, x + len * direction[0], y - top + len * direction[1]);
     }
 }
 
 /* trace rectangle whose opposite vertices are specified by (x1, y1) and (x2, y2) */
 void traceRect(image *img, int x1, int y1, int x2, int y2) {
     int tmp = x1;
+    int top = img->top;
+    int bottom = img->top + img->rows;
     if(tmp > x2) {
         x1 = x2;
         x2 = tmp;
@@ -82,25 +153,20 @@ void traceRect(image *img, int x1, int y1, int x2, int y2) {
         y1 = y2;
         y2 = tmp;
     }
-    int pos;
     for(int i = y2 - y1; i >= 0; --i) {
-        if(i + y1 >= 0 && i + y1 < img->height) {
-            if(x1 >= 0 && x1 < img->width)
+        if(i + y1 >= top && i + y1 < bottom) {
+            if(x1 >= 0 && x1 < (int) img->width)
                 unsafeSetPixel(img,x1,y1 + i);
-            if(x2 >= 0 && x2 < img->width)
+            if(x2 >= 0 && x2 < (int) img->width)
                 unsafeSetPixel(img,x2,y1 + i);
         }
     }
     for(int i = x2 - x1; i >= 0; --i) {
-        if(i + x1 >= 0 && i + x1 < img->width) {
-            if(y1 >= 0 && y1 < img->height) {
-                if(i + y1 >= 0 && i + y1 < img->datlen)
-                    unsafeSetPixel(img,x1 + i,y1);
-            }
-            if(y2 >= 0 && y2 < img->height) {
-                if(i + y2 >= 0 && i + y2 < img->datlen)
-                    unsafeSetPixel(img,x1 + i,y2);
-            }
+        if(i + x1 >= 0 && i + x1 < (int) img->width) {
+            if(y1 >= top && y1 < bottom)
+                unsafeSetPixel(img,x1 + i,y1);
+            if(y2 >= top && y2 < bottom)
+                unsafeSetPixel(img,x1 + i,y2);
         }
     }
 
@@ -109,6 +175,8 @@ void traceRect(image *img, int x1, int y1, int x2, int y2) {
 /* trace rectangle whose opposite vertices are specified by (x1, y1) and (x2, y2) */
 void fillRect(image *img, int x1, int y1, int x2, int y2) {
     int tmp = x1;
+    int top = img->top;
+    int bottom = img->top + img->rows;
     if(tmp > x2) {
         x1 = x2;
         x2 = tmp;
@@ -117,136 +185,542 @@ void fillRect(image *img, int x1, int y1, int x2, int y2) {
         y1 = y2;
         y2 = tmp;
     }
-    if(x1 >= img->width || y1 >= img->height || x2 < 0 || y2 < 0)
-        return;
-    if(x1 < 0)
-        x1 = 0;
-    if(y1 < 0)
-        y1 = 0;
-    if(x2 >= img->width)
-        x2 = img->width - 1;
-    if(y2 >= img->height)
-        y2 = img->height - 1;
-    for(; x1 <= x2; ++x1)
-        for(int y = y1; y <= y2; ++y)
-            unsafeSetPixel(img, x1, y);
+    if(y1 < top)
+        y1 = top;
+    if(y2 >= bottom)
+        y2 = bottom - 1;
+    for(; y1 <= y2; ++y1)
+        fillSpan(img, x1, x2, y1);
 }
 
-/* create image structure with specified parameters and return pointer to structure */
-image *iopen(uint16_t width, uint16_t height, int type) {
+/* set up the fields shared by in-memory and streamed images */
+static image *create(uint32_t width, uint32_t height, int type) {
     image *img = malloc(sizeof(image));
     switch(type) {
+        case BILEVEL:
+            img->bytesPerPixel = 0;
+            break;
         case GRAYSCALE:
+        case PALETTE:
             img->bytesPerPixel = 1;
             break;
         case FULLCOLOR:
-            img->bytesPerPixel = 3;
         default:
             img->bytesPerPixel = 3;
     }
+    img->stride = type == BILEVEL ? (width + 7) / 8 : (size_t) width * img->bytesPerPixel;
+    img->compression = NOCOMPRESSION;
     img->type = type;
     img->width = width;
     img->height = height;
+    img->top = 0;
+    img->rows = 0;
     img->color[0] = img->color[1] = img->color[2] = 0;
-    img->datlen = width * height * img->bytesPerPixel;
+    img->index = 0;
+    img->colors = 0;
+    img->data = NULL;
+    img->datlen = 0;
+    img->fp = NULL;
+    img->big = 0;
+    img->length = 0;
+    img->rowsPerStrip = height;
+    img->strips = 0;
+    img->stripOffsets = img->stripByteCounts = NULL;
+    img->packed = NULL;
+    img->tileSize = 0;
+    img->overview = NULL;
+    img->link = 0;
+    img->reduced = 0;
+    img->map = NULL;
+    return img;
+}
+
+/* allocate cleared pixel data for the given number of rows */
+static int hold(image *img, uint32_t rows) {
+    img->rows = rows;
+    img->datlen = img->stride * rows;
     if(!(img->data = malloc(img->datlen)))
-        return NULL;
+        return -1;
     memset(img->data,0,img->datlen);
+    return 0;
+}
+
+/* create image structure with specified parameters and return pointer to structure */
+image *iopen(uint32_t width, uint32_t height, int type) {
+    image *img = create(width, height, type);
+    if(hold(img, height)) {
+        iclose(img);
+        return NULL;
+    }
     return img;
 }
 
 /* free allocated memory */
 void iclose(image *img) {
-    free(img->data);
+    if(img->overview)
+        iclose(img->overview);
+    free(img->stripOffsets);
+    free(img->stripByteCounts);
+    free(img->packed);
+    if(img->map)
+        munmap(img->map, img->data - img->map + img->datlen);
+    else
+        free(img->data);
     free(img);
 }
 
+/* worst case length of size bytes after PackBits compression */
+static size_t packedSize(size_t size) {
+    return size + (size + 127) / 128;
+}
+
+/* PackBits compress size bytes of src into dst, which needs room for packedSize(size) bytes. Returns the compressed length */
+static size_t packBits(uint8_t const *src, size_t size, uint8_t *dst) {
+    size_t out = 0;
+    size_t i = 0;
+    size_t run, start;
+    while(i < size) {
+        for(run = 1; i + run < size && run < 128 && src[i + run] == src[i]; ++run);
+        if(run > 1) { /* repeat the next byte run times */
+            dst[out++] = 257 - run;
+            dst[out++] = src[i];
+            i += run;
+            continue;
+        }
+        /* copy bytes literally until a run of three begins */
+        for(start = i; i < size && i - start < 128; ++i) {
+            if(i + 2 < size && src[i] == src[i + 1] && src[i] == src[i + 2])
+                break;
+        }
+        dst[out++] = i - start - 1;
+        memcpy(dst + out, src + start, i - start);
+        out += i - start;
+    }
+    return out;
+}
+
+/* pick the strip layout and file format for an image about to be written, and open its file */
+static int begin(image *img, FILE *fp, uint32_t rowsPerStrip) {
+    size_t stride = img->stride;
+    img->fp = fp;
+    if(rowsPerStrip == 0)
+        rowsPerStrip = stride < STRIPSIZE ? STRIPSIZE / stride : 1;
+    if(rowsPerStrip > img->height)
+        rowsPerStrip = img->height;
+    uint32_t count = (img->height + rowsPerStrip - 1) / rowsPerStrip;
+    img->rowsPerStrip = rowsPerStrip;
+    img->strips = 0;
+    img->stripOffsets = malloc(sizeof(uint64_t) * count);
+    img->stripByteCounts = malloc(sizeof(uint64_t) * count);
+    /* pixel data at its worst PackBits expansion plus the strip tables and a generous allowance for the rest of the IFD */
+    img->big = (uint64_t) packedSize(stride) * img->height + (uint64_t) count * 8 + 4096 > CLASSICLIMIT;
+    if(!img->stripOffsets || !img->stripByteCounts || !fp)
+        return -1;
+    writeHeader(img);
+    return 0;
+}
+
+/* append size bytes to the file being written */
+static int put(image *img, void const *data, size_t size) {
+    img->length += size;
+    return fwrite(data, 1, size, img->fp) == size ? 0 : -1;
+}
+
+/* write the given rows of pixel data as the next strip */
+static int writeStrip(image *img, uint8_t const *data, uint32_t rows) {
+    size_t size = img->stride * rows;
+    if(img->compression == PACKBITS) {
+        if(!img->packed && !(img->packed = malloc(packedSize(img->stride) * img->rowsPerStrip)))
+            return -1;
+        size = 0;
+        for(uint32_t y = 0; y < rows; ++y) /* rows are packed separately */
+            size += packBits(data + y * img->stride, img->stride, img->packed + size);
+        data = img->packed;
+    }
+    img->stripOffsets[img->strips] = img->length;
+    img->stripByteCounts[img->strips++] = size;
+    return put(img, data, size);
+}
+
+/* lay out the tiles of a tiled image and hold one row of them */
+static int layTiles(image *img, uint32_t tileSize) {
+    uint32_t count = ((img->width + tileSize - 1) / tileSize) * ((img->height + tileSize - 1) / tileSize);
+    size_t stride = img->type == BILEVEL ? tileSize / 8 : (size_t) tileSize * img->bytesPerPixel;
+    img->tileSize = tileSize;
+    img->rowsPerStrip = tileSize < img->height ? tileSize : img->height;
+    img->stripOffsets = malloc(sizeof(uint64_t) * count);
+    img->stripByteCounts = malloc(sizeof(uint64_t) * count);
+    img->packed = malloc(stride * tileSize + packedSize(stride) * tileSize);
+    if(!img->stripOffsets || !img->stripByteCounts || !img->packed)
+        return -1;
+    return hold(img, img->rowsPerStrip);
+}
+
+/* cut the held rows into tiles and write them from left to right. Tiles on the right and bottom edges are padded to full size */
+static int writeTiles(image *img) {
+    uint32_t size = img->tileSize;
+    size_t stride = img->type == BILEVEL ? size / 8 : (size_t) size * img->bytesPerPixel;
+    size_t used, length;
+    uint8_t *tile = img->packed;
+    uint8_t *packed = img->packed + stride * size;
+    uint8_t const *data;
+    int err = 0;
+    for(size_t left = 0; left < img->stride && !err; left += stride) {
+        used = img->stride - left < stride ? img->stride - left : stride;
+        memset(tile, 0, stride * size);
+        for(uint32_t y = 0; y < img->rows; ++y)
+            memcpy(tile + y * stride, img->data + y * img->stride + left, used);
+        data = tile;
+        length = stride * size;
+        if(img->compression == PACKBITS) {
+            length = 0;
+            for(uint32_t y = 0; y < size; ++y) /* rows are packed separately */
+                length += packBits(tile + y * stride, stride, packed + length);
+            data = packed;
+        }
+        img->stripOffsets[img->strips] = img->length;
+        img->stripByteCounts[img->strips++] = length;
+        err = put(img, data, length);
+    }
+    return err;
+}
+
+/* store the color of pixel x of a held row in color, as one gray value or as {r,g,b} */
+static void sample(image const *img, uint8_t const *line, uint32_t x, uint8_t *color) {
+    if(img->type == BILEVEL)
+        color[0] = line[x >> 3] & 0x80 >> (x & 7) ? 255 : 0;
+    else if(img->type == PALETTE)
+        memcpy(color, img->palette[line[x]], 3);
+    else
+        memcpy(color, line + (size_t) x * img->bytesPerPixel, img->bytesPerPixel);
+}
+
+/* the number of white pixels in each pair of bits of a byte, one pair per byte of the result from the left */
+static uint32_t spread(uint32_t bits) {
+    bits -= bits >> 1 & 0x55;
+    return (bits >> 6 & 3) | (bits >> 4 & 3) << 8 | (bits >> 2 & 3) << 16 | (bits & 3) << 24;
+}
+
+/* average each block of 2 x 2 held pixels into a pixel of the overview, and write the overview's row of tiles once it is complete.
+ * Rows of tiles start at even rows, so no block is split between them. The overview is written to the same file, so it takes over the length for a while */
+static int reduce(image *img) {
+    image *small = img->overview;
+    int channels = small->bytesPerPixel;
+    uint8_t color[4][3];
+    uint32_t x, right, pairs;
+    int err = 0;
+    static uint8_t const shades[5] = {0, 64, 128, 191, 255};
+    small->compression = img->compression;
+    for(uint32_t y = img->top / 2; y < (img->top + img->rows + 1) / 2 && !err; ++y) {
+        uint8_t const *above = img->data + (size_t) (2 * y - img->top) * img->stride;
+        uint8_t const *below = 2 * y + 1 < img->top + img->rows ? above + img->stride : above;
+        uint8_t *out = small->data + (size_t) (y - small->top) * small->stride;
+        x = 0;
+        if(img->type == BILEVEL) { /* whole bytes make four gray pixels at once */
+            for(; 2 * x + 8 <= img->width; x += 4) {
+                pairs = spread(above[x / 4]) + spread(below[x / 4]);
+                for(int k = 0; k < 4; ++k)
+                    out[x + k] = shades[pairs >> (8 * k) & 7];
+            }
+        }
+        else if(img->type == small->type) { /* gray or full color, averaged one byte at a time */
+            for(; 2 * x + 1 < img->width; ++x)
+                for(int c = 0; c < channels; ++c)
+                    out[x * channels + c] = (above[2 * x * channels + c] + above[(2 * x + 1) * channels + c] + below[2 * x * channels + c] + below[(2 * x + 1) * channels + c] + 2) / 4;
+        }
+        for(; x < small->width; ++x) {
+            right = 2 * x + 1 < img->width ? 2 * x + 1 : 2 * x;
+            sample(img, above, 2 * x, color[0]);
+            sample(img, above, right, color[1]);
+            sample(img, below, 2 * x, color[2]);
+            sample(img, below, right, color[3]);
+            for(int c = 0; c < channels; ++c)
+                out[x * channels + c] = (color[0][c] + color[1][c] + color[2][c] + color[3][c] + 2) / 4;
+        }
+        if(y == small->top + small->rows - 1) {
+            small->length = img->length;
+            err = swrite(small);
+            img->length = small->length;
+        }
+    }
+    return err;
+}
+
+/* create a streamed image that holds one strip of rows at a time, and start writing its file */
+image *sopen(char *name, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip) {
+    return fsopen(fopen(name,"wb"), width, height, type, rowsPerStrip);
+}
+
+/* create a streamed image writing to fp, which must be positioned at its start. fp is closed if the image cannot be created */
+image *fsopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip) {
+    image *img = create(width, height, type);
+    if(begin(img, fp, rowsPerStrip) || hold(img, img->rowsPerStrip)) {
+        if(fp)
+            fclose(fp);
+        iclose(img);
+        return NULL;
+    }
+    return img;
+}
+
+/* create an image whose pixel data is the mapped pixel region of its file, laid out as consecutive uncompressed strips.
+ * New pages of the file read as zeros, so the data starts cleared without a pass over it, and the system writes pixels back as they are drawn */
+image *mapopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip) {
+    image *img = create(width, height, type);
+    struct stat info;
+    int fd = fp ? fileno(fp) : -1;
+    if(fd < 0 || fstat(fd, &info) || !S_ISREG(info.st_mode) || begin(img, fp, rowsPerStrip)) {
+        iclose(img);
+        return NULL;
+    }
+    uint64_t offset = img->length;
+    img->rows = height;
+    img->datlen = img->stride * height;
+    /* the blocks are reserved rather than left as a hole, so a full disk shows up here instead of as SIGBUS while drawing */
+    if(fflush(fp) || posix_fallocate(fd, 0, offset + img->datlen) || (img->map = mmap(NULL, offset + img->datlen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        img->map = NULL;
+        img->datlen = 0;
+        iclose(img);
+        rewind(fp); /* left as it was found, so the caller can stream to it instead */
+        ftruncate(fd, 0);
+        return NULL;
+    }
+    img->data = img->map + offset;
+    for(uint32_t y = 0; y < height; y += img->rowsPerStrip) {
+        img->stripOffsets[img->strips] = offset + y * img->stride;
+        img->stripByteCounts[img->strips++] = img->stride * (height - y < img->rowsPerStrip ? height - y : img->rowsPerStrip);
+    }
+    img->length = offset + img->datlen;
+    return img;
+}
+
+/* create a streamed tiled image and its overviews, which all hold one row of tiles at a time, and start writing their file */
+image *tsopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t tileSize) {
+    image *img = create(width, height, type);
+    image *level;
+    uint64_t size = 0;
+    int err = !fp;
+    tileSize = tileSize < 16 ? 16 : tileSize > TILELIMIT ? TILELIMIT : (tileSize + 15) / 16 * 16; /* TIFF tiles are a multiple of 16 pixels wide and long */
+    for(level = img; !err; level = level->overview) {
+        size_t stride = level->type == BILEVEL ? tileSize / 8 : (size_t) tileSize * level->bytesPerPixel;
+        uint64_t tiles = (uint64_t) ((level->width + tileSize - 1) / tileSize) * ((level->height + tileSize - 1) / tileSize);
+        /* tiles at their worst PackBits expansion, the tile tables and an allowance for the rest of the IFD */
+        size += (packedSize(stride) * tileSize + 16) * tiles + 4096;
+        err = layTiles(level, tileSize);
+        if(err || (level->width <= tileSize && level->height <= tileSize))
+            break;
+        /* overviews average blocks of pixels, which takes shades of gray or full color */
+        level->overview = create((level->width + 1) / 2, (level->height + 1) / 2, level->type == BILEVEL || level->type == GRAYSCALE ? GRAYSCALE : FULLCOLOR);
+        level->overview->reduced = 1;
+    }
+    for(level = img; level; level = level->overview) {
+        level->fp = fp;
+        level->big = size > CLASSICLIMIT;
+    }
+    if(err) {
+        if(fp)
+            fclose(fp);
+        iclose(img);
+        return NULL;
+    }
+    writeHeader(img);
+    return img;
+}
+
+/* write the held rows as a strip or a row of tiles, then hold the rows that follow them */
+int swrite(image *img) {
+    if(img->map) { /* every row is already in the file, the IFD goes after them */
+        img->top = img->height;
+        return fseek(img->fp, img->length, SEEK_SET);
+    }
+    if(img->rows == 0)
+        return 0;
+    int err = img->tileSize ? writeTiles(img) : writeStrip(img, img->data, img->rows);
+    if(img->overview && !err)
+        err = reduce(img);
+    img->top += img->rows;
+    if(img->height - img->top < img->rows) {
+        img->rows = img->height - img->top;
+        img->datlen = img->stride * img->rows;
+    }
+    return err;
+}
+
+/* flush remaining rows, finish the file and free allocated memory */
+int sclose(image *img) {
+    int err = 0;
+    uint64_t length;
+    while(img->top < img->height && !err)
+        err = swrite(img);
+    /* the IFDs of the overviews follow the one of the image, each linked from the one before */
+    length = img->length;
+    for(image *level = img; level && !err; level = level->overview) {
+        level->length = length;
+        writeIFD(level);
+        length = level->length;
+    }
+    if(ferror(img->fp)) /* a write of the IFD, or a buffered one of the strips, failed */
+        err = -1;
+    if(fclose(img->fp))
+        err = -1;
+    iclose(img);
+    return err;
+}
+
 /* write an entry to the image file directory */
-void writeIFDEntry(FILE *fp, uint16_t tag, uint16_t type, uint32_t valCount, uint32_t offset) {
-    fwrite(&tag, 2, 1, fp);
-    fwrite(&type, 2, 1, fp);
-    fwrite(&valCount, 4, 1, fp);
-    fwrite(&offset, 4, 1, fp);
+void writeIFDEntry(image *img, uint16_t tag, uint16_t type, uint64_t valCount, uint64_t value) {
+    put(img, &tag, 2);
+    put(img, &type, 2);
+    put(img, &valCount, img->big ? 8 : 4); /* both fields are 4 bytes in classic TIFF and 8 bytes in BigTIFF */
+    put(img, &value, img->big ? 8 : 4);
 }
 
-/* write the image header for the specified image */
-void writeHeader(image *img, FILE *fp) {
-    uint16_t b2;
-    uint32_t b4;
-    fwrite("II", 2, 1, fp); /* Little endian format        0-1 */ 
-    b2 = 42;
-    fwrite(&b2, 2, 1, fp); /* TIFF identification number   2-3 */
-    b4 = 8 + img->datlen; /* header + data + XResolution + YResolution */
-    fwrite(&b4, 4, 1, fp); /* offset of first IFD          4-7 */
+/* write values for an IFD entry. Values that fit in the entry are returned packed for writeIFDEntry, larger ones are written to the file and their offset is returned */
+static uint64_t writeValues(image *img, uint16_t type, uint64_t count, void const *values) {
+    static uint8_t const sizes[17] = {[BYTE] = 1, [ASCII] = 1, [SHORT] = 2, [LONG] = 4, [RATIONAL] = 8, [LONG8] = 8};
+    uint64_t size = sizes[type] * count;
+    uint64_t packed = 0;
+    if(size <= (img->big ? 8u : 4u)) {
+        memcpy(&packed, values, size);
+        return packed;
+    }
+    if(img->length % 2) /* values must begin on a word boundary */
+        put(img, &packed, 1);
+    packed = img->length;
+    put(img, values, size);
+    return packed;
+}
+
+/* write strip offsets or byte counts as LONG values in classic TIFF or LONG8 values in BigTIFF */
+static uint64_t writeStripValues(image *img, uint64_t const *values) {
+    if(img->big)
+        return writeValues(img, LONG8, img->strips, values);
+    uint32_t *narrow = malloc(sizeof(uint32_t) * img->strips);
+    for(uint32_t i = 0; i < img->strips; ++i)
+        narrow[i] = values[i];
+    uint64_t value = writeValues(img, LONG, img->strips, narrow);
+    free(narrow);
+    return value;
 }
 
-/* write the IFD for the specified image */
-void writeIFD(image *img, FILE *fp) {
+/* write the image header for the specified image. The offset of the IFD is filled in by writeIFD */
+void writeHeader(image *img) {
     uint16_t b2;
-    uint32_t b4;
+    uint64_t b8 = 0;
+    put(img, "II", 2); /* Little endian format        0-1 */
+    b2 = img->big ? 43 : 42;
+    put(img, &b2, 2); /* TIFF identification number   2-3 */
+    if(img->big) {
+        b2 = 8;
+        put(img, &b2, 2); /* BigTIFF offset size         4-5 */
+        b2 = 0;
+        put(img, &b2, 2); /* reserved                    6-7 */
+    }
+    img->link = img->length;
+    put(img, &b8, img->big ? 8 : 4); /* offset of first IFD   4-7 (8-15 in BigTIFF) */
+}
+
+/* write the IFD for the specified image after its strips, and point the header (or the IFD of the image it is an overview of) at it */
+void writeIFD(image *img) {
+    uint16_t const bits[3] = {8, 8, 8};
+    uint16_t const bit = 1;
+    uint32_t const resolution[2] = {1, 1};
+    uint64_t entries;
 
     switch(img->type) {
+        case BILEVEL:
         case GRAYSCALE:
-            b2 = 11;
+            entries = 11;
+            break;
+        case PALETTE:
+            entries = 12;
             break;
         case FULLCOLOR:
-            b2 = 12;
+            entries = 12;
             break;
         default:
             return;
     }
-    fwrite(&b2, 2, 1, fp); /* number of IFD entries*/
-
-    writeIFDEntry(fp, 256, SHORT, 1, img->width);             /* ImageWidth: number of columns per image */
-    writeIFDEntry(fp, 257, SHORT, 1, img->height);            /* ImageLength: number of scanlines */
-    if(img->type == FULLCOLOR)                                /* BitsPerSample: number of bits per pixel. 8-bits for range of 0-255 */
-        writeIFDEntry(fp, 258, SHORT, 3, 8 + 2 + img->datlen + b2*12 + 4 + 16);
-    else
-        writeIFDEntry(fp, 258, SHORT, 1, 8);
-    writeIFDEntry(fp, 259, SHORT, 1, 1);                      /* Compression: 1 = no compression, 2 = CCITT Group 3 1-Dimensional Modified Huffman run length encoding, 32773 = PackBits compression */
-    writeIFDEntry(fp, 262, SHORT, 1, img->type == FULLCOLOR ? 2 : 1);                  /* PhotometricInterpretation: 1 = black is zero, 0 = white is zero 3 = palette color with colormap (black is zero in this case) */
-    writeIFDEntry(fp, 273, LONG, 1, 8);                       /* StripOffsets: the offset in bytes from the beinning of the file to each strip. In this case, the image data comes right after the header, then the IFD */
-    if(img->type == FULLCOLOR)
-        writeIFDEntry(fp, 277, SHORT, 1, 3);                  /* SamplesPerPixel: 3 */
-    writeIFDEntry(fp, 278, SHORT, 1, img->height);            /* RowsPerStrip: number of rows in each strip. (I am only doing one strip, so it will be all of them) */
-    writeIFDEntry(fp, 279, LONG, 1, img->datlen);             /* StripByteCounts: number of bytes in each strip */
-    writeIFDEntry(fp, 282, RATIONAL, 1, 12 + img->datlen + b2 * 12);  /* XResolution number of pixels per resolution unit in imageWidth. 1/1 */
-    writeIFDEntry(fp, 283, RATIONAL, 1, 20 + img->datlen + b2 * 12);  /* XResolution nuYmber of pixels per resolution unit in imageLength. 1/1 */
-    writeIFDEntry(fp, 296, SHORT, 1, 1);                      /* ResolutionUnit: 1 = no unit, 2 = inch, 3 = centimeter, default is inch */
-    b4 = 0;
-    fwrite(&b4,4,1,fp);
-
-    /* define X and Y resolution (just one) */
-    b4 = 1;
-    for(int i = 0; i < 4; ++i)
-        fwrite(&b4, 4, 1, fp);
-
-    /* define bitsPerSample (3 samples, 8 bits each) */
-    b2 = 8;
-    for(int i = 0; i < 3 && img->type == FULLCOLOR; ++i)
-        fwrite(&b2, 2, 1, fp);
-}
-
-/* write the complete tiff file with the specified name from the specified image structure. */
-void writeFile(image *img, char *name) {
-    uint16_t width = img->width;
-    uint16_t length = img->height;
-    
-    uint8_t b1;
-    uint16_t b2;
-    uint32_t b4;
+    if(img->tileSize) /* four tile tags replace the three strip tags */
+        ++entries;
+    if(img->reduced)
+        ++entries;
 
-    /* uint8_t header = [(uint8_t)'I',(uint8_t)'I',] */
-
-    /* header */
-    FILE *fp = fopen(name,"wb");
-    writeHeader(img,fp);
+    /* values too large to fit in their entries come first */
+    uint64_t bitsPerSample = writeValues(img, SHORT, img->type == FULLCOLOR ? 3 : 1, img->type == BILEVEL ? &bit : bits); /* 8 bits per sample for range of 0-255, or 1 for black and white */
+    uint64_t xResolution = writeValues(img, RATIONAL, 1, resolution);
+    uint64_t yResolution = writeValues(img, RATIONAL, 1, resolution);
+    uint64_t stripOffsets = writeStripValues(img, img->stripOffsets);
+    uint64_t stripByteCounts = writeStripValues(img, img->stripByteCounts);
+    uint64_t colorMap = 0;
+    if(img->type == PALETTE) { /* all reds, then all greens, then all blues, as 16 bit intensities */
+        uint16_t map[3][256] = {{0}};
+        for(int i = 0; i < img->colors; ++i)
+            for(int c = 0; c < 3; ++c)
+                map[c][i] = img->palette[i][c] * 257;
+        colorMap = writeValues(img, SHORT, 3 * 256, map);
+    }
+    uint64_t next = 0;
+    if(img->length % 2)
+        put(img, &next, 1);
+    uint64_t offset = img->length;
 
-    fwrite(img->data, 1, img->datlen, fp);
+    put(img, &entries, img->big ? 8 : 2); /* number of IFD entries*/
+    uint16_t count = img->big ? 8 : 4;
+    uint16_t stripType = img->big ? LONG8 : LONG;
 
-    /* IFD */
-    writeIFD(img,fp);
-    fclose(fp);
+    if(img->reduced)
+        writeIFDEntry(img, 254, LONG, 1, 1);                   /* NewSubfileType: 1 = reduced resolution version of another image in the file */
+    writeIFDEntry(img, 256, LONG, 1, img->width);             /* ImageWidth: number of columns per image */
+    writeIFDEntry(img, 257, LONG, 1, img->height);            /* ImageLength: number of scanlines */
+    writeIFDEntry(img, 258, SHORT, img->type == FULLCOLOR ? 3 : 1, bitsPerSample); /* BitsPerSample: number of bits per sample */
+    writeIFDEntry(img, 259, SHORT, 1, img->compression);       /* Compression: 1 = no compression, 2 = CCITT Group 3 1-Dimensional Modified Huffman run length encoding, 32773 = PackBits compression */
+    writeIFDEntry(img, 262, SHORT, 1, img->type == FULLCOLOR ? 2 : img->type == PALETTE ? 3 : 1); /* PhotometricInterpretation: 1 = black is zero, 0 = white is zero 3 = palette color with colormap (black is zero in this case) */
+    if(!img->tileSize)
+        writeIFDEntry(img, 273, stripType, img->strips, stripOffsets); /* StripOffsets: the offset in bytes from the beinning of the file to each strip. The strips come right after the header, then the IFD */
+    if(img->type == FULLCOLOR)
+        writeIFDEntry(img, 277, SHORT, 1, 3);                  /* SamplesPerPixel: 3 */
+    if(!img->tileSize) {
+        writeIFDEntry(img, 278, LONG, 1, img->rowsPerStrip);     /* RowsPerStrip: number of rows in each strip. The last strip may hold fewer */
+        writeIFDEntry(img, 279, stripType, img->strips, stripByteCounts); /* StripByteCounts: number of bytes in each strip */
+    }
+    writeIFDEntry(img, 282, RATIONAL, 1, xResolution);         /* XResolution number of pixels per resolution unit in imageWidth. 1/1 */
+    writeIFDEntry(img, 283, RATIONAL, 1, yResolution);         /* YResolution number of pixels per resolution unit in imageLength. 1/1 */
+    writeIFDEntry(img, 296, SHORT, 1, 1);                      /* ResolutionUnit: 1 = no unit, 2 = inch, 3 = centimeter, default is inch */
+    if(img->type == PALETTE)
+        writeIFDEntry(img, 320, SHORT, 3 * 256, colorMap);    /* ColorMap: red, green and blue intensities of each palette index */
+    if(img->tileSize) {
+        writeIFDEntry(img, 322, LONG, 1, img->tileSize);       /* TileWidth: number of columns in each tile */
+        writeIFDEntry(img, 323, LONG, 1, img->tileSize);       /* TileLength: number of rows in each tile. Tiles on the edges are padded */
+        writeIFDEntry(img, 324, stripType, img->strips, stripOffsets); /* TileOffsets: offset of each tile, left to right, then top to bottom */
+        writeIFDEntry(img, 325, stripType, img->strips, stripByteCounts); /* TileByteCounts: number of bytes in each tile */
+    }
+    if(img->overview) /* the overview links its IFD here once it is written */
+        img->overview->link = img->length;
+    put(img, &next, count); /* offset of the next IFD, none until it is linked */
 
+    /* point the header (or the IFD before) at the IFD. Memory streams end where they were last written, so seek back to the end by offset */
+    fseek(img->fp, img->link, SEEK_SET);
+    fwrite(&offset, count, 1, img->fp);
+    fseek(img->fp, img->length, SEEK_SET);
+}
 
-}
\ No newline at end of file
+/* write the complete tiff file with the specified name from the specified image structure. */
+int writeFile(image *img, char *name) {
+    int err = begin(img, fopen(name,"wb"), 0);
+    for(uint32_t y = 0; y < img->height && !err; y += img->rowsPerStrip)
+        err = writeStrip(img, img->data + y * img->stride, img->height - y < img->rowsPerStrip ? img->height - y : img->rowsPerStrip);
+    if(!err)
+        writeIFD(img);
+    if(img->fp && ferror(img->fp))
+        err = -1;
+    if(img->fp && fclose(img->fp))
+        err = -1;
+    img->fp = NULL;
+    free(img->stripOffsets);
+    free(img->stripByteCounts);
+    free(img->packed);
+    img->stripOffsets = img->stripByteCounts = NULL;
+    img->packed = NULL;
+    return err;
+}
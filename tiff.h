@@ -1,24 +1,64 @@
-/* This library defines functions used to create and draw tiff images. This library supports 8-bit full color RGB, and 8 bit grayscale. */
+/* This library defines functions used to create and draw tiff images. This library supports 8-bit full color RGB, 8 bit grayscale, 8 bit palette color, and 1 bit black and white (bilevel).
+ * Images can be held in memory as a whole and written with writeFile, or streamed to disk one band of rows at a time with sopen, swrite and sclose.
+ * Files that would not fit the 4 GB offsets of classic TIFF are written as BigTIFF. Strips can be PackBits compressed by setting compression before they are written.
+ * Streamed images can also be written in square tiles followed by overviews of half the size each, so viewers can read only the tiles they show at any zoom.
+ * Uncompressed images can be drawn straight into a memory mapped file with mapopen. */
+
+#include <stdio.h>
+#include <stdint.h>
 
 #define SETCOLOR(IMG,R,G,B) { IMG->color[0] = R; IMG->color[1] = G; IMG->color[2] = B; }
 
+#define BILEVEL   0 /* 1 bit per pixel, colors are drawn as black or white depending on their brightness */
 #define GRAYSCALE 1
+#define PALETTE   2 /* 1 byte per pixel indexing a table of up to 256 colors built with addColor */
 #define FULLCOLOR 3
 
-typedef struct {
-    uint16_t width; /* horizontal width of image */
-    uint16_t height; /* vertical height of image */
+#define NOCOMPRESSION 1
+#define PACKBITS      32773
+
+#define TILELIMIT 8192 /* largest tile width and length of tsopen, each level holds a whole row of tiles */
+
+typedef struct image {
+    uint32_t width; /* horizontal width of image */
+    uint32_t height; /* vertical height of image */
+    uint32_t top; /* first image row held in data. Drawing outside of rows [top, top + rows) is clipped */
+    uint32_t rows; /* number of image rows held in data */
     uint8_t color[3]; /* current color {red, green, blue}*/
-    uint8_t *data; /* image pixel data expressed as a series of {r,g,b} triplets */
-    uint32_t datlen; /* length of data in bytes */
-    uint8_t bytesPerPixel;
+    uint8_t index; /* palette index of the current color in palette images */
+    uint8_t palette[256][3]; /* colors of a palette image */
+    uint16_t colors; /* number of colors in the palette */
+    uint8_t *data; /* pixel data of the held rows expressed as a series of {r,g,b} triplets, or 8 pixels per byte (leftmost in the high bit) for bilevel images */
+    size_t datlen; /* length of data in bytes */
+    size_t stride; /* length of a row of data in bytes */
+    uint8_t bytesPerPixel; /* 0 for bilevel images */
     char type;
+    uint16_t compression; /* NOCOMPRESSION or PACKBITS */
+    FILE *fp; /* output file of a streamed image */
+    char big; /* 1 if the file is written as BigTIFF */
+    uint64_t length; /* number of bytes written to fp so far */
+    uint32_t rowsPerStrip; /* number of image rows stored in each strip of the file, or in each row of tiles */
+    uint32_t strips; /* number of strips (or tiles) written so far */
+    uint64_t *stripOffsets; /* file offset of each strip or tile */
+    uint64_t *stripByteCounts; /* length in bytes of each strip or tile */
+    uint8_t *packed; /* room for one compressed strip, or for one tile and its compressed form */
+    uint32_t tileSize; /* width and length of the tiles of a tiled image, 0 if it is stored in strips */
+    struct image *overview; /* image of half the width and height, made from this one and written to the same file, or NULL */
+    uint64_t link; /* file offset of the field pointing at the IFD of this image */
+    char reduced; /* 1 for the overviews of a tiled image */
+    uint8_t *map; /* start of the memory mapped file of a mapped image, whose data points into it, or NULL */
 } image;
 
-void setColor(image *img, uint8_t r, uint8_t g, uint8_t b); /* set current color to the RGB color r,g,b */
+void setColor(image *img, uint8_t r, uint8_t g, uint8_t b); /* set current color to the RGB color r,g,b. Palette images use the closest color in their palette */
+
+void setIndex(image *img, uint8_t index); /* set current color to the given entry of the palette */
+
+int addColor(image *img, uint8_t r, uint8_t g, uint8_t b); /* add the RGB color r,g,b to the palette and return its index, or -1 if the palette is full */
 
 void fillColor(image *img); /* set entire image to current color */
 
+void fillSpan(image *img, int x1, int x2, int y); /* set pixels x1 through x2 of row y to current color */
+
 void setPixel(image *img, int x, int y); /* set pixel (x,y) to current color */
 
 void unsafeSetPixel(image *img, int x, int y); /* same as setPixel, but it does not protect against bad (x, y) pairs */
@@ -29,14 +69,26 @@ void traceRect(image *img, int x1, int y1, int x2, int y2); /* traces the outlin
 
 void fillRect(image *img, int x1, int y1, int x2, int y2);
 
-image *iopen(uint16_t width, uint16_t height, int type); /* creates an image structure with the specified size */
+image *iopen(uint32_t width, uint32_t height, int type); /* creates an image structure with the specified size */
 
 void iclose(image *img); /* frees the allocated memory */
 
-void writeIFDEntry(FILE *fp, uint16_t tag, uint16_t type, uint32_t valCount, uint32_t offset); /* writes an Image File Directory Entry. */
+image *sopen(char *name, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip); /* creates a streamed image that holds one strip of rows at a time and writes it to a .tiff file with the given name. rowsPerStrip of 0 picks a default */
+
+image *fsopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip); /* same as sopen, but writes to the open file fp, which sclose closes. fp can be a memory stream from open_memstream */
+
+image *tsopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t tileSize); /* same as fsopen, but the image is written in tiles of tileSize pixels square (rounded up to a multiple of 16, at most TILELIMIT), one row of tiles at a time, followed by overviews of half the size each until one fits in a single tile */
+
+image *mapopen(FILE *fp, uint32_t width, uint32_t height, int type, uint32_t rowsPerStrip); /* same as fsopen, but fp must be a regular file open for reading and writing ("w+b"), whose space is reserved and memory mapped. All rows are held in the mapped file and drawn in place, uncompressed, and swrite only moves past them. Returns NULL and leaves fp open if fp cannot be mapped */
+
+int swrite(image *img); /* write the held rows as the next strip (or row of tiles) and move on to the following rows */
+
+int sclose(image *img); /* write the remaining rows and the IFD, then close the file and free the allocated memory. Returns 0 on success */
+
+void writeIFDEntry(image *img, uint16_t tag, uint16_t type, uint64_t valCount, uint64_t value); /* writes an Image File Directory Entry. */
 
-void writeHeader(image *img, FILE *fp);
+void writeHeader(image *img);
 
-void writeIFD(image *img, FILE *fp);
+void writeIFD(image *img);
 
-void writeFile(image *img, char *name); /* write the data stored in the given image structure to a .tiff file with the given name */
\ No newline at end of file
+int writeFile(image *img, char *name); /* write the data stored in the given image structure to a .tiff file with the given name. Returns 0 on success */